@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _COMPIZ_FROST_H
+#define _COMPIZ_FROST_H
+
+#include <compiz-core.h>
+
+COMPIZ_BEGIN_DECLS
+
+#define FROST_ABIVERSION 20081118
+
+/* Other plugins sample the frost surface through the functions table
+   found at the display private index in the "index" display option,
+   after checkPluginABI ("frost", FROST_ABIVERSION).
+
+   Each output has its own grid. Its texture holds the bump map, normal
+   in rgb and height in alpha, or only the height in alpha, stored as
+   height * 0.5 + 0.5, when heightOnly is set. Textures and their contents stay valid until the
+   generation of the screen changes. */
+
+typedef struct _FrostGridInfo {
+    /* output the grid covers, in screen coordinates */
+    int x, y;
+    int width, height;
+
+    GLuint texture;
+    GLenum target;
+    Bool   heightOnly;
+
+    /* screen coordinates to texture coordinates, usable as texgen
+       planes */
+    GLfloat sPlane[4];
+    GLfloat tPlane[4];
+
+    /* the surface is still moving */
+    Bool active;
+} FrostGridInfo;
+
+/* fills up to nInfo entries and returns the number of grids */
+typedef int (*FrostGetGridsProc) (CompScreen	*s,
+				  FrostGridInfo *info,
+				  int		nInfo);
+
+/* adds the parts of the screen where the surface moves to region */
+typedef void (*FrostGetActiveRegionProc) (CompScreen *s,
+					  Region     region);
+
+/* changes whenever the textures or their contents change */
+typedef unsigned int (*FrostGetGenerationProc) (CompScreen *s);
+
+typedef struct _FrostFunctions {
+    FrostGetGridsProc	     getGrids;
+    FrostGetActiveRegionProc getActiveRegion;
+    FrostGetGenerationProc   getGeneration;
+} FrostFunctions;
+
+COMPIZ_END_DECLS
+
+#endif
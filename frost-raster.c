@@ -0,0 +1,727 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "frost-raster.h"
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+Bool
+frostBuildBrush (FrostBrush *brush,
+		 float	    radius)
+{
+    float *kernel, r2, dist;
+    int	  e, size, x, y, i;
+
+    r2 = MAX (radius, 0.5f);
+    e  = (int) ceilf (r2) + 1;
+    r2 *= r2;
+
+    size = 2 * e + 1;
+
+    kernel = malloc (sizeof (float) * (size * size +
+				       (e + 1) * BRUSH_PROFILE_STEPS));
+    if (!kernel)
+	return FALSE;
+
+    for (y = -e; y <= e; y++)
+	for (x = -e; x <= e; x++)
+	    kernel[(y + e) * size + x + e] = exp2f (-(x * x + y * y) / r2);
+
+    for (i = 0; i < (e + 1) * BRUSH_PROFILE_STEPS; i++)
+    {
+	dist = (float) i / BRUSH_PROFILE_STEPS;
+	kernel[size * size + i] = exp2f (-(dist * dist) / r2);
+    }
+
+    if (brush->kernel)
+	free (brush->kernel);
+
+    brush->radius  = sqrtf (r2);
+    brush->extent  = e;
+    brush->kernel  = kernel;
+    brush->profile = kernel + size * size;
+
+    return TRUE;
+}
+
+void
+frostFreeBrush (FrostBrush *brush)
+{
+    if (brush->kernel)
+	free (brush->kernel);
+
+    brush->kernel  = NULL;
+    brush->profile = NULL;
+}
+
+#define OUT_LEFT   (1 << 0)
+#define OUT_RIGHT  (1 << 1)
+#define OUT_TOP	   (1 << 2)
+#define OUT_BOTTOM (1 << 3)
+
+static int
+outCode (float x,
+	 float y,
+	 float x0,
+	 float y0,
+	 float x1,
+	 float y1)
+{
+    int code = 0;
+
+    if (x < x0)
+	code |= OUT_LEFT;
+    else if (x > x1)
+	code |= OUT_RIGHT;
+
+    if (y < y0)
+	code |= OUT_TOP;
+    else if (y > y1)
+	code |= OUT_BOTTOM;
+
+    return code;
+}
+
+/* Cohen-Sutherland, returns FALSE when the segment misses the rectangle */
+static Bool
+clipLine (float *ax,
+	  float *ay,
+	  float *bx,
+	  float *by,
+	  float x0,
+	  float y0,
+	  float x1,
+	  float y1)
+{
+    int	  codeA, codeB, code, i;
+    float x, y;
+
+    codeA = outCode (*ax, *ay, x0, y0, x1, y1);
+    codeB = outCode (*bx, *by, x0, y0, x1, y1);
+
+    for (i = 0;; i++)
+    {
+	if (!(codeA | codeB))
+	    return TRUE;
+
+	if (codeA & codeB)
+	    return FALSE;
+
+	/* exact arithmetic needs at most two cuts per end point, what is
+	   left after four is rounding near a corner that would otherwise
+	   bounce between its two edges forever */
+	if (i == 4)
+	{
+	    *ax = MIN (MAX (*ax, x0), x1);
+	    *ay = MIN (MAX (*ay, y0), y1);
+	    *bx = MIN (MAX (*bx, x0), x1);
+	    *by = MIN (MAX (*by, y0), y1);
+
+	    return TRUE;
+	}
+
+	code = codeA ? codeA : codeB;
+
+	if (code & OUT_TOP)
+	{
+	    x = *ax + (*bx - *ax) * (y0 - *ay) / (*by - *ay);
+	    y = y0;
+	}
+	else if (code & OUT_BOTTOM)
+	{
+	    x = *ax + (*bx - *ax) * (y1 - *ay) / (*by - *ay);
+	    y = y1;
+	}
+	else if (code & OUT_LEFT)
+	{
+	    y = *ay + (*by - *ay) * (x0 - *ax) / (*bx - *ax);
+	    x = x0;
+	}
+	else
+	{
+	    y = *ay + (*by - *ay) * (x1 - *ax) / (*bx - *ax);
+	    x = x1;
+	}
+
+	if (code == codeA)
+	{
+	    *ax	  = x;
+	    *ay	  = y;
+	    codeA = outCode (x, y, x0, y0, x1, y1);
+	}
+	else
+	{
+	    *bx	  = x;
+	    *by	  = y;
+	    codeB = outCode (x, y, x0, y0, x1, y1);
+	}
+    }
+}
+
+/* amplitude at x, y on the segment from a to b, measured along its
+   larger extent */
+static float
+lineAmp (float ax,
+	 float ay,
+	 float bx,
+	 float by,
+	 float x,
+	 float y,
+	 float ampA,
+	 float ampB)
+{
+    float t;
+
+    if (fabsf (bx - ax) >= fabsf (by - ay))
+	t = (bx != ax) ? (x - ax) / (bx - ax) : 0.0f;
+    else
+	t = (y - ay) / (by - ay);
+
+    t = MIN (MAX (t, 0.0f), 1.0f);
+
+    return ampA + (ampB - ampA) * t;
+}
+
+/* Sutherland-Hodgman against one edge, keeps the part of the convex
+   polygon where v[axis] * sign >= bound * sign. The amplitude in the
+   third component is interpolated with the position */
+static int
+clipPolygon (float (*in)[3],
+	     int   n,
+	     float (*out)[3],
+	     int   axis,
+	     float sign,
+	     float bound)
+{
+    const float *a, *b;
+    float	da, db, t;
+    int		i, m = 0;
+
+    for (i = 0; i < n; i++)
+    {
+	a = in[i];
+	b = in[(i + 1) % n];
+
+	da = (a[axis] - bound) * sign;
+	db = (b[axis] - bound) * sign;
+
+	if (da >= 0.0f)
+	{
+	    out[m][0] = a[0];
+	    out[m][1] = a[1];
+	    out[m][2] = a[2];
+	    m++;
+	}
+
+	if ((da >= 0.0f) != (db >= 0.0f))
+	{
+	    t = da / (da - db);
+
+	    out[m][0] = a[0] + (b[0] - a[0]) * t;
+	    out[m][1] = a[1] + (b[1] - a[1]) * t;
+	    out[m][2] = a[2] + (b[2] - a[2]) * t;
+	    m++;
+	}
+    }
+
+    return m;
+}
+
+/* Map screen coordinates into the grid and drop or clip every primitive
+   that cannot reach it, so neither backend indexes outside the heightfield
+   and every vertex fits an XPoint. The clip rectangle is grown by the
+   brush extent as stamps near the edge still touch the grid. A triangle
+   that crosses it is cut into a fan of up to five, so clipped needs room
+   for FROST_CLIP_SIZE (n) vertices. Returns the number written. */
+int
+frostClipVertices (const FrostField *f,
+		   const FrostBrush *brush,
+		   GLenum	    type,
+		   const XPoint	    *p,
+		   const float	    *amp,
+		   int		    n,
+		   XPoint	    *clipped,
+		   float	    *clippedAmp)
+{
+    float sx, sy, x0, y0, x1, y1, ax, ay, bx, by, cx, cy, dx, dy;
+    float v[8][3], w[8][3];
+    int	  i, j, k, code, all, m = 0;
+
+    sx = (float) f->width  / f->outputWidth;
+    sy = (float) f->height / f->outputHeight;
+
+    x0 = y0 = -brush->extent;
+    x1 = f->width  - 1 + brush->extent;
+    y1 = f->height - 1 + brush->extent;
+
+    switch (type) {
+    case GL_POINTS:
+	for (i = 0; i < n; i++)
+	{
+	    ax = (p[i].x - f->x) * sx;
+	    ay = (p[i].y - f->y) * sy;
+
+	    if (outCode (ax, ay, x0, y0, x1, y1))
+		continue;
+
+	    if (amp)
+		clippedAmp[m] = amp[i];
+
+	    clipped[m].x = floorf (ax);
+	    clipped[m].y = floorf (ay);
+	    m++;
+	}
+	break;
+    case GL_LINES:
+	for (i = 0; i + 1 < n; i += 2)
+	{
+	    ax = cx = (p[i].x - f->x) * sx;
+	    ay = cy = (p[i].y - f->y) * sy;
+	    bx = dx = (p[i + 1].x - f->x) * sx;
+	    by = dy = (p[i + 1].y - f->y) * sy;
+
+	    if (!clipLine (&ax, &ay, &bx, &by, x0, y0, x1, y1))
+		continue;
+
+	    if (amp)
+	    {
+		clippedAmp[m]	  = lineAmp (cx, cy, dx, dy, ax, ay,
+					     amp[i], amp[i + 1]);
+		clippedAmp[m + 1] = lineAmp (cx, cy, dx, dy, bx, by,
+					     amp[i], amp[i + 1]);
+	    }
+
+	    clipped[m].x     = floorf (ax);
+	    clipped[m].y     = floorf (ay);
+	    clipped[m + 1].x = floorf (bx);
+	    clipped[m + 1].y = floorf (by);
+	    m += 2;
+	}
+	break;
+    case GL_TRIANGLES:
+	for (i = 0; i + 2 < n; i += 3)
+	{
+	    code = ~0;
+	    all	 = 0;
+
+	    for (j = 0; j < 3; j++)
+	    {
+		v[j][0] = (p[i + j].x - f->x) * sx;
+		v[j][1] = (p[i + j].y - f->y) * sy;
+		v[j][2] = amp ? amp[i + j] : 0.0f;
+
+		k = outCode (v[j][0], v[j][1], x0, y0, x1, y1);
+
+		code &= k;
+		all  |= k;
+	    }
+
+	    /* entirely on the outside of one edge */
+	    if (code)
+		continue;
+
+	    k = 3;
+
+	    /* the cut vertices lie outside the grid by the brush extent, so
+	       rounding them moves no edge by more than a cell where it
+	       crosses the grid */
+	    if (all)
+	    {
+		k = clipPolygon (v, k, w, 0,  1.0f, x0);
+		k = clipPolygon (w, k, v, 0, -1.0f, x1);
+		k = clipPolygon (v, k, w, 1,  1.0f, y0);
+		k = clipPolygon (w, k, v, 1, -1.0f, y1);
+	    }
+
+	    for (j = 1; j + 1 < k; j++)
+	    {
+		if (amp)
+		{
+		    clippedAmp[m]     = v[0][2];
+		    clippedAmp[m + 1] = v[j][2];
+		    clippedAmp[m + 2] = v[j + 1][2];
+		}
+
+		clipped[m].x	 = floorf (v[0][0]);
+		clipped[m].y	 = floorf (v[0][1]);
+		clipped[m + 1].x = floorf (v[j][0]);
+		clipped[m + 1].y = floorf (v[j][1]);
+		clipped[m + 2].x = floorf (v[j + 1][0]);
+		clipped[m + 2].y = floorf (v[j + 1][1]);
+		m += 3;
+	    }
+	}
+	break;
+    }
+
+    return m;
+}
+
+#undef OUT_LEFT
+#undef OUT_RIGHT
+#undef OUT_TOP
+#undef OUT_BOTTOM
+
+#define CELL(x, y) ((f->d) + f->pitch * (y) + (x))
+
+/* stamp the precomputed brush kernel, clipped to the grid, one kernel row
+   at a time */
+static void
+rasterPoints (FrostField       *f,
+	      const FrostBrush *brush,
+	      const XPoint     *p,
+	      const float      *amp,
+	      int	       n,
+	      float	       add)
+{
+    const float *k;
+    float	*row;
+    int		e, size, x0, x1, y0, y1, x, y;
+
+    e	 = brush->extent;
+    size = 2 * e + 1;
+
+    while (n--)
+    {
+	if (amp)
+	    add = *amp++;
+
+	x0 = MAX (p->x - e, 0);
+	x1 = MIN (p->x + e, f->width - 1);
+	y0 = MAX (p->y - e, 0);
+	y1 = MIN (p->y + e, f->height - 1);
+
+	for (y = y0; y <= y1; y++)
+	{
+	    row = CELL (x0, y);
+	    k	= brush->kernel + (y - p->y + e) * size + (x0 - p->x + e);
+
+	    for (x = 0; x <= x1 - x0; x++)
+		row[x] += (add - row[x]) * k[x];
+	}
+
+	p++;
+    }
+}
+
+/* anti-aliased DDA, each step along the major axis writes a cross section
+   weighted by the brush profile at its distance from the ideal line, the
+   amplitude runs linearly from one end to the other */
+static void
+rasterLines (FrostField	      *f,
+	     const FrostBrush *brush,
+	     const XPoint     *p,
+	     const float      *amp,
+	     int	      n,
+	     float	      v)
+{
+    int	  x1, y1, x2, y2;
+    Bool  steep;
+    int	  tmp;
+    int	  e, major, minor, majorMax, minorMax, c, cMax;
+    float slope, pos, cosT, *d;
+    float a1, a2, ampSlope, fTmp;
+
+#define SWAP(v0, v1) \
+    tmp = v0;	     \
+    v0 = v1;	     \
+    v1 = tmp
+
+    e	 = brush->extent;
+    cMax = (e + 1) * BRUSH_PROFILE_STEPS;
+
+    while (n > 1)
+    {
+	x1 = p->x;
+	y1 = p->y;
+
+	p++;
+	n--;
+
+	x2 = p->x;
+	y2 = p->y;
+
+	p++;
+	n--;
+
+	a1 = a2 = v;
+	if (amp)
+	{
+	    a1 = amp[0];
+	    a2 = amp[1];
+
+	    amp += 2;
+	}
+
+	steep = abs (y2 - y1) > abs (x2 - x1);
+	if (steep)
+	{
+	    SWAP (x1, y1);
+	    SWAP (x2, y2);
+
+	    majorMax = f->height;
+	    minorMax = f->width;
+	}
+	else
+	{
+	    majorMax = f->width;
+	    minorMax = f->height;
+	}
+
+	if (x1 > x2)
+	{
+	    SWAP (x1, x2);
+	    SWAP (y1, y2);
+
+	    fTmp = a1;
+	    a1	 = a2;
+	    a2	 = fTmp;
+	}
+
+	slope	 = (x1 == x2) ? 0.0f : (float) (y2 - y1) / (x2 - x1);
+	ampSlope = (x1 == x2) ? 0.0f : (a2 - a1) / (x2 - x1);
+	cosT	 = 1.0f / sqrtf (1.0f + slope * slope);
+
+	for (major = MAX (x1, 0); major <= MIN (x2, majorMax - 1); major++)
+	{
+	    pos = y1 + slope * (major - x1);
+	    v	= a1 + ampSlope * (major - x1);
+
+	    for (minor = MAX ((int) floorf (pos + 0.5f) - e, 0);
+		 minor <= MIN ((int) floorf (pos + 0.5f) + e, minorMax - 1);
+		 minor++)
+	    {
+		c = (int) (fabsf (minor - pos) * cosT * BRUSH_PROFILE_STEPS);
+		if (c >= cMax)
+		    continue;
+
+		d = steep ? CELL (minor, major) : CELL (major, minor);
+
+		*d += (v - *d) * brush->profile[c];
+	    }
+	}
+    }
+
+#undef SWAP
+
+}
+
+/* floor of n / d for d > 0 */
+static int
+floorDiv (int n,
+	  int d)
+{
+    return (n >= 0) ? n / d : -((d - 1 - n) / d);
+}
+
+/* Scanline fill with the sampling rule of the GL path, which draws the
+   vertices at cell centres and so covers a cell when its centre is inside
+   the triangle. Here that is the lattice point (x, y). The ends of each
+   span are rounded exactly in integers, centres on an edge are covered.
+   Only the covered span of each row is written, so the cost follows the
+   area of the triangle. Vertices must be clipped, which keeps the
+   products below within an int. Amplitudes per vertex are interpolated
+   over the plane through the three of them. */
+static void
+rasterTriangles (FrostField   *f,
+		 const XPoint *p,
+		 const float  *amp,
+		 int	      n,
+		 float	      v)
+{
+    const XPoint *a, *b, *c, *e0, *e1, *tmp;
+    float	 *row, va, vb, vc, gx, gy, det, value;
+    int		 x, y, x0, x1, y0, y1, dy, num;
+
+#define SWAP(v0, v1) \
+    tmp = v0;	     \
+    v0 = v1;	     \
+    v1 = tmp
+
+    while (n > 2)
+    {
+	a = p;
+	b = p + 1;
+	c = p + 2;
+
+	/* sort by y so that a is the top and c the bottom vertex */
+	if (b->y < a->y)
+	{
+	    SWAP (a, b);
+	}
+	if (c->y < a->y)
+	{
+	    SWAP (a, c);
+	}
+	if (c->y < b->y)
+	{
+	    SWAP (b, c);
+	}
+
+	gx = gy = 0.0f;
+	va = v;
+
+	if (amp)
+	{
+	    va = amp[a - p];
+	    vb = amp[b - p];
+	    vc = amp[c - p];
+
+	    det = (float) (b->x - a->x) * (c->y - a->y) -
+		  (float) (c->x - a->x) * (b->y - a->y);
+
+	    /* zero area, the cells it covers lie on one segment */
+	    if (det == 0.0f)
+	    {
+		va = (va + vb + vc) / 3.0f;
+	    }
+	    else
+	    {
+		gx = ((vb - va) * (c->y - a->y) - (vc - va) * (b->y - a->y)) /
+		     det;
+		gy = ((vc - va) * (b->x - a->x) - (vb - va) * (c->x - a->x)) /
+		     det;
+	    }
+
+	    amp += 3;
+	}
+
+	p += 3;
+	n -= 3;
+
+	y0 = MAX (a->y, 0);
+	y1 = MIN (c->y, f->height - 1);
+
+	for (y = y0; y <= y1; y++)
+	{
+	    if (a->y == c->y)
+	    {
+		/* degenerate, all three vertices on one row */
+		x0 = MIN (a->x, MIN (b->x, c->x));
+		x1 = MAX (a->x, MAX (b->x, c->x));
+	    }
+	    else
+	    {
+		/* the long edge a-c crosses every row, the short one is a-b
+		   above b and b-c from there on */
+		e0 = (y < b->y) ? a : b;
+		e1 = (y < b->y) ? b : c;
+
+		dy  = c->y - a->y;
+		num = (c->x - a->x) * (y - a->y);
+
+		x0 = a->x - floorDiv (-num, dy);
+		x1 = a->x + floorDiv (num, dy);
+
+		if (e0->y == e1->y)
+		{
+		    /* flat bottom, the long edge ends at c and the row
+		       runs from there to b */
+		    x0 = MIN (x0, e0->x);
+		    x1 = MAX (x1, e0->x);
+		}
+		else
+		{
+		    dy  = e1->y - e0->y;
+		    num = (e1->x - e0->x) * (y - e0->y);
+
+		    /* ceiling and floor are monotonic, so the smaller
+		       ceiling and the larger floor bound the span whichever
+		       edge is on the left */
+		    x0 = MIN (x0, e0->x - floorDiv (-num, dy));
+		    x1 = MAX (x1, e0->x + floorDiv (num, dy));
+		}
+	    }
+
+	    x0 = MAX (x0, 0);
+	    x1 = MIN (x1, f->width - 1);
+
+	    row = CELL (0, y);
+
+	    value = va + gx * (x0 - a->x) + gy * (y - a->y);
+
+	    for (x = x0; x <= x1; x++, value += gx)
+		row[x] = value;
+	}
+    }
+
+#undef SWAP
+
+}
+
+void
+frostRasterVertices (FrostField	      *f,
+		     const FrostBrush *brush,
+		     GLenum	      type,
+		     const XPoint     *p,
+		     const float      *amp,
+		     int	      n,
+		     float	      v)
+{
+    switch (type) {
+    case GL_POINTS:
+	rasterPoints (f, brush, p, amp, n, v);
+	break;
+    case GL_LINES:
+	rasterLines (f, brush, p, amp, n, v);
+	break;
+    case GL_TRIANGLES:
+	rasterTriangles (f, p, amp, n, v);
+	break;
+    }
+}
+
+/* p holds pairs of points on the same row, fill from first to second */
+void
+frostRasterSpans (FrostField   *f,
+		  const XPoint *p,
+		  int	       n,
+		  float	       v)
+{
+    float *row;
+    int	  x;
+
+    while (n > 1)
+    {
+	row = CELL (0, p[0].y);
+
+	for (x = p[0].x; x <= p[1].x; x++)
+	    row[x] = v;
+
+	p += 2;
+	n -= 2;
+    }
+}
+
+#undef CELL
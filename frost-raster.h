@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _FROST_RASTER_H
+#define _FROST_RASTER_H
+
+/* Clipping and the software rasterizers. They only depend on Xlib and GL
+   types so the tools can link them without the compositor. */
+
+#include <X11/Xlib.h>
+#include <GL/gl.h>
+
+/* samples per cell in the brush profile */
+#define BRUSH_PROFILE_STEPS 16
+
+/* Gaussian brush that falls to one half at radius cells. The square
+   kernel of 2 * extent + 1 cells stamps points, the radial profile of
+   (extent + 1) * BRUSH_PROFILE_STEPS samples weights line cross sections */
+typedef struct _FrostBrush {
+    float radius;
+    int	  extent;
+    float *kernel;
+    float *profile;
+} FrostBrush;
+
+/* heightfield of one grid and the screen rectangle it covers, d points
+   at cell (0, 0) and a border of one cell lies around the grid */
+typedef struct _FrostField {
+    float *d;
+    int	  width, height, pitch;
+
+    int	  x, y, outputWidth, outputHeight;
+} FrostField;
+
+Bool
+frostBuildBrush (FrostBrush *brush,
+		 float	    radius);
+
+void
+frostFreeBrush (FrostBrush *brush);
+
+/* vertices frostClipVertices may write for n */
+#define FROST_CLIP_SIZE(n) (5 * (n))
+
+/* amp is NULL or holds an amplitude per vertex, clippedAmp then gets
+   those of the clipped vertices */
+int
+frostClipVertices (const FrostField *f,
+		   const FrostBrush *brush,
+		   GLenum	    type,
+		   const XPoint	    *p,
+		   const float	    *amp,
+		   int		    n,
+		   XPoint	    *clipped,
+		   float	    *clippedAmp);
+
+/* amplitudes are taken per vertex from amp and interpolated along lines
+   and across triangles the way GL shades them, or are all v when amp is
+   NULL */
+void
+frostRasterVertices (FrostField	      *f,
+		     const FrostBrush *brush,
+		     GLenum	      type,
+		     const XPoint     *p,
+		     const float      *amp,
+		     int	      n,
+		     float	      v);
+
+void
+frostRasterSpans (FrostField   *f,
+		  const XPoint *p,
+		  int	       n,
+		  float	       v);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _FROST_SHM_H
+#define _FROST_SHM_H
+
+/* Layout of the shared memory segment external processes use to
+   disturb the frost surface. The plugin creates one segment per screen,
+   named after the shm_name option followed by "-" and the screen number.
+
+   Batches of points or line segments go through a ring of slots. A
+   producer claims a slot by incrementing head, marks it odd while it
+   writes and even once the batch is complete, the plugin reads every
+   completed slot once per frame. Slots overwritten before the plugin
+   got to them are skipped.
+
+   Height deltas are whole planes added to the surface, stretched over
+   the screen, from one producer at a time. Delta k is written to
+   heights[k & 1], whose seq is odd while it is written, and published by
+   setting heightSeq to k. Only the latest delta is applied, the plugin
+   copies it and drops the copy when seq changed meanwhile.
+
+   Amplitudes and heights are clamped to [-1, 1], batches and deltas
+   holding a value that is not finite are dropped. */
+
+#define FROST_SHM_MAGIC	  0x4d485346 /* "FSHM" */
+#define FROST_SHM_VERSION 2
+
+#define FROST_SHM_SLOTS	       64
+#define FROST_SHM_SLOT_POINTS  256
+#define FROST_SHM_HEIGHT_SIZE  128
+
+#define FROST_SHM_POINTS 0
+#define FROST_SHM_LINES	 1
+
+/* same layout as an XPoint */
+typedef struct _FrostShmPoint {
+    short x, y;
+} FrostShmPoint;
+
+typedef struct _FrostShmSlot {
+    /* 2 * position + 1 while written, 2 * position + 2 when complete */
+    volatile unsigned int seq;
+
+    unsigned int type;
+    unsigned int n;
+    float	 amplitude;
+
+    FrostShmPoint p[FROST_SHM_SLOT_POINTS];
+} FrostShmSlot;
+
+typedef struct _FrostShmHeights {
+    /* 2 * delta + 1 while written, 2 * delta + 2 when complete */
+    volatile unsigned int seq;
+
+    unsigned int width, height;
+    float	 d[FROST_SHM_HEIGHT_SIZE * FROST_SHM_HEIGHT_SIZE];
+} FrostShmHeights;
+
+typedef struct _FrostShm {
+    /* set last, once the rest of the segment is initialized */
+    volatile unsigned int magic;
+    unsigned int	  version;
+
+    /* screen size in pixels, points are in screen coordinates */
+    unsigned int width, height;
+
+    volatile unsigned int head;
+    volatile unsigned int heightSeq;
+
+    FrostShmHeights heights[2];
+    FrostShmSlot    slot[FROST_SHM_SLOTS];
+} FrostShm;
+
+static inline FrostShmSlot *
+frostShmBeginBatch (FrostShm	 *shm,
+		    unsigned int *position)
+{
+    FrostShmSlot *slot;
+
+    *position = __sync_fetch_and_add (&shm->head, 1);
+
+    slot = &shm->slot[*position % FROST_SHM_SLOTS];
+    slot->seq = 2 * *position + 1;
+
+    __sync_synchronize ();
+
+    return slot;
+}
+
+static inline void
+frostShmCommitBatch (FrostShmSlot *slot,
+		     unsigned int position)
+{
+    __sync_synchronize ();
+
+    slot->seq = 2 * position + 2;
+}
+
+static inline FrostShmHeights *
+frostShmBeginHeights (FrostShm	   *shm,
+		      unsigned int *delta)
+{
+    FrostShmHeights *h;
+
+    *delta = shm->heightSeq + 1;
+
+    h = &shm->heights[*delta & 1];
+    h->seq = 2 * *delta + 1;
+
+    __sync_synchronize ();
+
+    return h;
+}
+
+static inline void
+frostShmCommitHeights (FrostShm	       *shm,
+		       FrostShmHeights *h,
+		       unsigned int    delta)
+{
+    __sync_synchronize ();
+
+    h->seq = 2 * delta + 2;
+
+    __sync_synchronize ();
+
+    shm->heightSeq = delta;
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _FROST_TRACE_H
+#define _FROST_TRACE_H
+
+/* Disturbances and frame timings can be recorded to a trace file and fed
+   back through the simulation later. The file is a sequence of records,
+   every recording session starts with its own start record and vertices
+   records are followed by their points and, with TRACE_AMPLITUDES set,
+   an amplitude per point. */
+
+#include <string.h>
+#include <X11/Xlib.h>
+
+#define TRACE_MAGIC   0x52544652 /* "FRTR" */
+#define TRACE_VERSION 2
+
+#define TRACE_START    0
+#define TRACE_VERTICES 1
+#define TRACE_STEP     2
+#define TRACE_PAINT    3
+
+/* step flag */
+#define TRACE_WIPE (1 << 0)
+
+/* vertices flag */
+#define TRACE_AMPLITUDES (1 << 1)
+
+typedef struct _FrostTraceRecord {
+    unsigned char  kind;
+    unsigned char  screen;
+    unsigned short flags;
+
+    /* microseconds since the previous record */
+    unsigned int time;
+
+    /* start: magic and version
+       vertices: primitive type and number of points, amplitude in f0
+       step: number of steps and their duration, swept sector in f0, f1
+       paint: duration of the frame in b */
+    int	  a, b;
+    float f0, f1;
+} FrostTraceRecord;
+
+typedef struct _FrostTraceReader {
+    const unsigned char *p, *end;
+    int			valid;
+} FrostTraceReader;
+
+static inline void
+frostTraceBegin (FrostTraceReader *reader,
+		 const void	  *data,
+		 size_t		  size)
+{
+    reader->p	  = data;
+    reader->end	  = reader->p + size;
+    reader->valid = 0;
+}
+
+/* Returns 1 and the next record other than a start record, with points
+   and amplitudes pointing at the unaligned points and amplitudes of a
+   vertices record, amplitudes is NULL without TRACE_AMPLITUDES. Returns 0
+   at the end of the trace, where a record cut short by an interrupted
+   recording also ends it, and -1 for a trace that is not one. Traces of
+   version 1 never carry amplitudes. */
+static inline int
+frostTraceNext (FrostTraceReader *reader,
+		FrostTraceRecord *r,
+		const void	 **points,
+		const void	 **amplitudes)
+{
+    size_t size;
+
+    for (;;)
+    {
+	if (reader->end - reader->p < (long) sizeof (*r))
+	    return 0;
+
+	memcpy (r, reader->p, sizeof (*r));
+
+	if (r->kind == TRACE_START)
+	{
+	    reader->valid = r->a == TRACE_MAGIC &&
+			    r->b >= 1 && r->b <= TRACE_VERSION;
+	    if (!reader->valid)
+		return -1;
+
+	    reader->p += sizeof (*r);
+	    continue;
+	}
+
+	if (!reader->valid)
+	    return -1;
+
+	*points	    = NULL;
+	*amplitudes = NULL;
+
+	if (r->kind == TRACE_VERTICES)
+	{
+	    if (r->b <= 0)
+		return -1;
+
+	    size = sizeof (XPoint);
+	    if (r->flags & TRACE_AMPLITUDES)
+		size += sizeof (float);
+
+	    if ((reader->end - reader->p - sizeof (*r)) / size <
+		(unsigned long) r->b)
+		return 0;
+
+	    *points = reader->p + sizeof (*r);
+	    if (r->flags & TRACE_AMPLITUDES)
+		*amplitudes = reader->p + sizeof (*r) + sizeof (XPoint) * r->b;
+
+	    reader->p += size * r->b;
+	}
+
+	reader->p += sizeof (*r);
+
+	return 1;
+    }
+}
+
+#endif
@@ -31,22 +31,125 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <compiz-core.h>
 
+#include "compiz-frost.h"
+#include "frost-shm.h"
+#include "frost-raster.h"
+#include "frost-trace.h"
+
+/* grid rows the physics and brush constants are tuned for, other
+   resolutions are scaled to look the same on screen */
 #define TEXTURE_SIZE 256
 
 #define K 0.1964f
 
+/* the simulation advances in fixed steps of STEP_MS, at most STEP_MAX of
+   them per frame */
+#define STEP_MS  16
+#define STEP_MAX 4
+
+/* activity a grid gets from a disturbance, counted down as it freezes */
+#define COUNT_MAX 3000
+
+/* frost mode grows ice in tiles of ICE_TILE * ICE_TILE cells, only tiles
+   that changed in the last step or border a change are visited */
+#define ICE_TILE	   16
+#define ICE_TILE_ACTIVE	   (1 << 0)
+#define ICE_TILE_NEXT	   (1 << 1)
+
+/* chance out of 256 per step that a cell touching ice grows, crystal
+   tips with a single frozen neighbour grow much faster than the gaps
+   between them fill */
+#define ICE_TIP_CHANCE	   64
+#define ICE_FILL_CHANCE	   6
+#define ICE_GROW_STEP	   48
+#define ICE_SEED_CHANCE	   16
+
+/* cells melted around the brush on top of its extent */
+#define ICE_MELT_EXTRA	   2
+
+#define ICE_OPACITY	   0.75f
 #define TEXTURE_NUM 3
 
+/* heightfield rows are padded to whole 64 byte cache lines */
+#define ROW_ALIGN 16
+
+/* distance in floats between the two heightfields of a grid on top of
+   their size, keeps d0[i] and d1[i] out of the same cache set */
+#define FIELD_STAGGER (ROW_ALIGN * 3)
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#ifndef GL_PIXEL_UNPACK_BUFFER_ARB
+#define GL_PIXEL_UNPACK_BUFFER_ARB 0x88EC
+#endif
+
+#ifndef GL_STREAM_DRAW_ARB
+#define GL_STREAM_DRAW_ARB 0x88E0
+#endif
+
+#ifndef GL_WRITE_ONLY_ARB
+#define GL_WRITE_ONLY_ARB 0x88B9
+#endif
+
+#ifndef GL_FUNC_ADD_EXT
+#define GL_FUNC_ADD_EXT 0x8006
+#endif
+
+#ifndef GL_FUNC_REVERSE_SUBTRACT_EXT
+#define GL_FUNC_REVERSE_SUBTRACT_EXT 0x800B
+#endif
+
+typedef void (*FrostGenBuffersProc) (GLsizei n,
+				     GLuint  *buffers);
+typedef void (*FrostDeleteBuffersProc) (GLsizei	     n,
+					const GLuint *buffers);
+typedef void (*FrostBindBufferProc) (GLenum target,
+				     GLuint buffer);
+typedef void (*FrostBufferDataProc) (GLenum	    target,
+				     GLsizeiptr	    size,
+				     const GLvoid   *data,
+				     GLenum	    usage);
+typedef GLvoid *(*FrostMapBufferProc) (GLenum target,
+				       GLenum access);
+typedef GLboolean (*FrostUnmapBufferProc) (GLenum target);
+typedef void (*FrostBlendEquationProc) (GLenum mode);
+
+/* what one of our texture units holds, kept between window draws */
+typedef struct _frostUnitState {
+    int	   unit;
+    GLuint texture;
+
+    /* grid whose texgen planes are loaded, NULL when they were given
+       under a window transform and must be set again */
+    struct _frostGrid *planes;
+} frostUnitState;
+
+/* fragment env parameters whose last values are remembered */
+#define ENV_CACHE_SIZE 8
+
 typedef struct _frostFunction {
     struct _frostFunction *next;
 
-    int handle;
-    int target;
-    int param;
-    int unit;
+    int  handle;
+    int  target;
+    int  param;
+    int  unit;
+    Bool heightOnly;
 } frostFunction;
 
 #define TINDEX(fs, i) (((fs)->tIndex + (i)) % TEXTURE_NUM)
@@ -63,6 +166,8 @@ static CompMetadata frostMetadata;
 
 static int displayPrivateIndex;
 
+static int functionsPrivateIndex;
+
 static int frostLastPointerX = 0;
 static int frostLastPointerY = 0;
 
@@ -74,7 +179,37 @@ static int frostLastPointerY = 0;
 #define FROST_DISPLAY_OPTION_TITLE_WAVE       5
 #define FROST_DISPLAY_OPTION_POINT            6
 #define FROST_DISPLAY_OPTION_LINE             7
-#define FROST_DISPLAY_OPTION_NUM              8
+#define FROST_DISPLAY_OPTION_RAIN_SEED        8
+#define FROST_DISPLAY_OPTION_BRUSH_RADIUS     9
+#define FROST_DISPLAY_OPTION_HUGE_PAGES       10
+#define FROST_DISPLAY_OPTION_HEIGHT_ONLY      11
+#define FROST_DISPLAY_OPTION_NORMAL_MODE      12
+#define FROST_DISPLAY_OPTION_WAVE_SPEED       13
+#define FROST_DISPLAY_OPTION_DAMPING          14
+#define FROST_DISPLAY_OPTION_FREEZE_RATE      15
+#define FROST_DISPLAY_OPTION_FROST_MODE       16
+#define FROST_DISPLAY_OPTION_POST_PASS        17
+#define FROST_DISPLAY_OPTION_SNAPSHOT         18
+#define FROST_DISPLAY_OPTION_SNAPSHOT_QUANTIZE 19
+#define FROST_DISPLAY_OPTION_TRACE_FILE       20
+#define FROST_DISPLAY_OPTION_REPLAY           21
+#define FROST_DISPLAY_OPTION_BATCH            22
+#define FROST_DISPLAY_OPTION_SHM_NAME         23
+#define FROST_DISPLAY_OPTION_ABI              24
+#define FROST_DISPLAY_OPTION_INDEX            25
+#define FROST_DISPLAY_OPTION_RESOLUTION       26
+#define FROST_DISPLAY_OPTION_NUM              27
+
+#define NORMAL_MODE_EXACT 0
+#define NORMAL_MODE_FAST  1
+#define NORMAL_MODE_TABLE 2
+#define NORMAL_MODE_LAST  NORMAL_MODE_TABLE
+
+/* the normal table covers gradients in [-2, 2) in steps of 1 / 64 along
+   each axis */
+#define NORMAL_TABLE_BITS  8
+#define NORMAL_TABLE_SIZE  (1 << NORMAL_TABLE_BITS)
+#define NORMAL_TABLE_SCALE 64.0f
 
 typedef struct _frostDisplay {
     int		    screenPrivateIndex;
@@ -84,40 +219,181 @@ typedef struct _frostDisplay {
     HandleEventProc handleEvent;
 
     float offsetScale;
+
+    /* per step coefficients shared by both backends, derived from the
+       wave speed, damping and freeze rate options. Speed and fade apply
+       to each of the subSteps a step is split into */
+    float stepSpeed;
+    float stepFade;
+    int	  stepFreeze;
+    int	  subSteps;
+
+    /* size of a cell relative to one of a TEXTURE_SIZE grid and the
+       matching gradient scale of the normal map */
+    float cellScale;
+    float normalScale;
+
+    /* brush in grid cells */
+    FrostBrush brush;
+
+    /* one rain timer serves every screen that has rain enabled */
+    CompTimeoutHandle rainHandle;
+
+    /* normal map staging buffer, shared by all screens since it only
+       lives between encoding and texture upload */
+    unsigned char *scratch;
+    int		  scratchSize;
+
+    /* BGR normal for every quantized gradient pair, built on first use */
+    unsigned char *normalTable;
+
+    /* disturbance trace being recorded, appended through traceBuffer */
+    int		   traceFd;
+    unsigned char  *traceBuffer;
+    int		   traceFill;
+    struct timeval traceLast;
+    Bool	   traceReplay;
 } frostDisplay;
 
-typedef struct _frostScreen {
-    PreparePaintScreenProc preparePaintScreen;
-    DonePaintScreenProc    donePaintScreen;
-    DrawWindowTextureProc  drawWindowTexture;
+/* simulation grid covering one output */
+typedef struct _frostGrid {
+    /* output geometry in screen coordinates */
+    int x, y;
+    int outputWidth, outputHeight;
 
-    int grabIndex;
     int width, height;
 
-    GLuint program;
+    /* floats per heightfield row, cell (x, y) is at d[pitch * (y + 1) + x + 1]
+       and the first cell of every row is cache line aligned */
+    int pitch;
+
     GLuint texture[TEXTURE_NUM];
 
+    /* current texture holds only the height in its alpha channel and
+       normals are derived while painting */
+    Bool heightOnly;
+
     int     tIndex;
-    GLenum  target;
     GLfloat tx, ty;
 
     int count;
 
+    void  *data;
+    int	  capacity;
+    float *d0;
+    float *d1;
+
+    /* frost mode ice density, one byte per cell, and the state of its
+       tiles */
+    unsigned char *ice;
+    unsigned char *iceTiles;
+    int		  iceTilesX, iceTilesY;
+    int		  iceActive;
+    unsigned int  iceStep;
+
+    /* rows changed since the last upload and since the last damage */
+    int iceY0, iceY1;
+    int iceDamageY0, iceDamageY1;
+
+    GLuint iceTexture;
+} frostGrid;
+
+typedef struct _frostScreen {
+    PreparePaintScreenProc preparePaintScreen;
+    DonePaintScreenProc    donePaintScreen;
+    DrawWindowTextureProc  drawWindowTexture;
+    OutputChangeNotifyProc outputChangeNotify;
+    PaintOutputProc	   paintOutput;
+
+    int grabIndex;
+
+    frostGrid *grids;
+    int	      nGrid;
+
+    GLenum target;
+
+    /* bumped whenever the textures other plugins sample change */
+    unsigned int generation;
+
     GLuint fbo;
     GLint  fboStatus;
 
-    void	  *data;
-    float	  *d0;
-    float	  *d1;
-    unsigned char *t0;
+    /* simulation program shared by all grids, the texel size is a
+       local parameter so it only depends on the texture target */
+    GLuint program;
+    GLenum programTarget;
 
-    CompTimeoutHandle rainHandle;
-    CompTimeoutHandle wiperHandle;
+    /* pending creation of the commonly used fragment functions */
+    CompTimeoutHandle prewarmHandle;
+
+    /* pixel unpack buffer the software path writes its normal map into,
+       only used when the pixel buffer object procs are available */
+    GLuint pbo;
+    Bool   pboMapped;
+
+    FrostGenBuffersProc	   genBuffers;
+    FrostDeleteBuffersProc deleteBuffers;
+    FrostBindBufferProc	   bindBuffer;
+    FrostBufferDataProc	   bufferData;
+    FrostMapBufferProc	   mapBuffer;
+    FrostUnmapBufferProc   unmapBuffer;
+
+    /* simulation time not yet consumed by a whole step */
+    int stepTime;
+
+    /* start of the frame being painted, only kept while tracing */
+    struct timeval paintStart;
+
+    /* input segment of external producers, next slot and height delta
+       to consume */
+    FrostShm	 *shm;
+    char	 *shmName;
+    unsigned int shmTail;
+    unsigned int shmHeightSeq;
+
+    /* private copy of the latest height delta and the texture one sign
+       of it is uploaded to on the GPU path */
+    FrostShmHeights *shmHeights;
+    GLuint	    shmTexture;
+    Bool	    shmSubtractWarned;
+    Bool	    shmInvalidWarned;
+
+    /* reverse subtraction takes the negative part of a height delta
+       off the height textures */
+    FrostBlendEquationProc blendEquation;
+
+    Bool rain;
+
+    unsigned int rainState;
 
+    Bool  wiper;
     float wiperAngle;
     float wiperSpeed;
 
+    /* sector swept by the wiper since the last simulation step */
+    Bool  wipe;
+    float wipeAngle0, wipeAngle1;
+
     frostFunction *bumpMapFunctions;
+    frostFunction *iceFunctions;
+
+    /* the output being painted gets one screen space refraction pass
+       instead of per window bump mapping */
+    Bool   postPass;
+    GLuint postProgram;
+    GLenum postTarget;
+
+    /* copy of the painted scene the post pass samples from */
+    GLuint sceneTexture;
+    GLenum sceneTarget;
+    int	   sceneWidth, sceneHeight;
+
+    /* unit and env parameter state left set up by the last window draw,
+       torn down once the output is painted */
+    frostUnitState bumpState;
+    frostUnitState iceState;
+    GLfloat	   env[ENV_CACHE_SIZE][4];
+    unsigned int   envValid;
 } frostScreen;
 
 #define GET_FROST_DISPLAY(d)					   \
@@ -137,13 +413,11 @@ typedef struct _frostScreen {
 static Bool
 frostRainTimeout (void *closure);
 
-static Bool
-frostWiperTimeout (void *closure);
-
 static const char *frostFpString =
     "!!ARBfp1.0"
 
     "PARAM param = program.local[0];"
+    "PARAM texel = program.local[1];"
     "ATTRIB t11  = fragment.texcoord[0];"
 
     "TEMP t01, t21, t10, t12;"
@@ -154,10 +428,10 @@ static const char *frostFpString =
     "TEX c11,  t11, texture[1], %s;"
 
     /* sample offsets */
-    "ADD t01, t11, { - %f, 0.0, 0.0, 0.0 };"
-    "ADD t21, t11, {   %f, 0.0, 0.0, 0.0 };"
-    "ADD t10, t11, { 0.0, - %f, 0.0, 0.0 };"
-    "ADD t12, t11, { 0.0,   %f, 0.0, 0.0 };"
+    "SUB t01, t11, texel.xwww;"
+    "ADD t21, t11, texel.xwww;"
+    "SUB t10, t11, texel.wyww;"
+    "ADD t12, t11, texel.wyww;"
 
     /* fetch nesseccary samples */
     "TEX c01, t01, texture[1], %s;"
@@ -190,6 +464,20 @@ static const char *frostFpString =
 
     "END";
 
+/* offset the scene copy on unit 0 by the normal map on unit 1 */
+static const char *frostPostFpString =
+    "!!ARBfp1.0"
+
+    "PARAM scale = program.local[0];"
+    "TEMP normal, coord;"
+
+    "TEX normal, fragment.texcoord[1], texture[1], %s;"
+    "MAD normal, normal, 2.0, -1.0;"
+    "MAD coord, normal.yxzz, scale, fragment.texcoord[0];"
+    "TEX result.color, coord, texture[0], %s;"
+
+    "END";
+
 static int
 loadFragmentProgram (CompScreen *s,
 		     GLuint	*program,
@@ -223,33 +511,45 @@ loadFragmentProgram (CompScreen *s,
     return 1;
 }
 
+/* build the simulation program for the current target, once */
 static int
 loadfrostProgram (CompScreen *s)
 {
-    char buffer[1024];
+    const char *t;
+    char       *buffer;
+    int	       size, status;
 
     FROST_SCREEN (s);
 
-    if (fs->target == GL_TEXTURE_2D)
-	sprintf (buffer, frostFpString,
-		 "2D", "2D",
-		 1.0f / fs->width,  1.0f / fs->width,
-		 1.0f / fs->height, 1.0f / fs->height,
-		 "2D", "2D", "2D", "2D");
-    else
-	sprintf (buffer, frostFpString,
-		 "RECT", "RECT",
-		 1.0f, 1.0f, 1.0f, 1.0f,
-		 "RECT", "RECT", "RECT", "RECT");
+    if (fs->program && fs->programTarget == fs->target)
+	return 1;
+
+    t = (fs->target == GL_TEXTURE_2D) ? "2D" : "RECT";
+
+    /* the template has six target names */
+    size = strlen (frostFpString) + 6 * strlen (t) + 1;
+
+    buffer = malloc (size);
+    if (!buffer)
+	return 0;
+
+    snprintf (buffer, size, frostFpString, t, t, t, t, t, t);
 
-    return loadFragmentProgram (s, &fs->program, buffer);
+    status = loadFragmentProgram (s, &fs->program, buffer);
+    if (status)
+	fs->programTarget = fs->target;
+
+    free (buffer);
+
+    return status;
 }
 
 static int
 getBumpMapFragmentFunction (CompScreen  *s,
 			    CompTexture *texture,
 			    int		unit,
-			    int		param)
+			    int		param,
+			    Bool	heightOnly)
 {
     frostFunction    *function;
     CompFunctionData *data;
@@ -264,9 +564,10 @@ getBumpMapFragmentFunction (CompScreen  *s,
 
     for (function = fs->bumpMapFunctions; function; function = function->next)
     {
-	if (function->param  == param &&
-	    function->unit   == unit  &&
-	    function->target == target)
+	if (function->param	 == param  &&
+	    function->unit	 == unit   &&
+	    function->target	 == target &&
+	    function->heightOnly == heightOnly)
 	    return function->handle;
     }
 
@@ -286,10 +587,57 @@ getBumpMapFragmentFunction (CompScreen  *s,
 	    }
 	}
 
+	/* rebuild the normal map texel from the four neighbouring heights,
+	   the same way softwareUpdate does, program.env[param + 1] holds
+	   the texel size and the gradient scale. Heights are filtered
+	   linearly, so coarse grids still give continuous normals */
+	if (heightOnly)
+	{
+	    const char *fetch = (fs->target == GL_TEXTURE_2D) ? "2D" : "RECT";
+
+	    snprintf (str, 1024,
+		      "TEX normal, fragment.texcoord[%d], texture[%d], %s;"
+
+		      "ADD offset, fragment.texcoord[%d], program.env[%d].zyzz;"
+		      "TEX temp, offset, texture[%d], %s;"
+		      "MOV bump.x, temp.w;"
+		      "SUB offset, fragment.texcoord[%d], program.env[%d].zyzz;"
+		      "TEX temp, offset, texture[%d], %s;"
+		      "SUB bump.x, bump.x, temp.w;"
+
+		      "SUB offset, fragment.texcoord[%d], program.env[%d].xzzz;"
+		      "TEX temp, offset, texture[%d], %s;"
+		      "MOV bump.y, temp.w;"
+		      "ADD offset, fragment.texcoord[%d], program.env[%d].xzzz;"
+		      "TEX temp, offset, texture[%d], %s;"
+		      "SUB bump.y, bump.y, temp.w;"
+
+		      "MUL bump.xy, bump, program.env[%d].w;"
+		      "MOV bump.z, 1.0;"
+		      "DP3 bump.w, bump, bump;"
+		      "RSQ bump.w, bump.w;"
+		      "MUL bump.w, bump.w, 0.5;"
+		      "MAD normal.xyz, bump, bump.w, 0.5;"
+		      "MOV t01, normal;",
+
+		      unit, unit, fetch,
+		      unit, param + 1, unit, fetch,
+		      unit, param + 1, unit, fetch,
+		      unit, param + 1, unit, fetch,
+		      unit, param + 1, unit, fetch,
+		      param + 1);
+
+	    if (!addDataOpToFunctionData (data, str))
+	    {
+		destroyFunctionData (data);
+		return 0;
+	    }
+	}
+
 	snprintf (str, 1024,
 
 		  /* get frost normal from frost normal map */
-		  "TEX t01, vTexCoord, texture[1], 2D;"
+		  "%s"
 
 		  /* save frost */
 		  "MOV t02, t01;"
@@ -306,6 +654,7 @@ getBumpMapFragmentFunction (CompScreen  *s,
 		  "MUL t01, t01, { frostHeight, frostHeight, frostHeight, frostHeight };"
 		  "ADD t02, t02, t01;",
 
+		  heightOnly ? "" : "TEX t01, vTexCoord, texture[1], 2D;",
 		  unit, unit,
 		  (fs->target == GL_TEXTURE_2D) ? "2D" : "RECT",
 		  param);
@@ -362,6 +711,8 @@ getBumpMapFragmentFunction (CompScreen  *s,
 	    function->param  = param;
 	    function->unit   = unit;
 
+	    function->heightOnly = heightOnly;
+
 	    function->next = fs->bumpMapFunctions;
 	    fs->bumpMapFunctions = function;
 	}
@@ -374,14 +725,212 @@ getBumpMapFragmentFunction (CompScreen  *s,
     return 0;
 }
 
+/* blend the ice density over the window, program.env[param] holds the
+   premultiplied ice color */
+static int
+getIceFragmentFunction (CompScreen  *s,
+			CompTexture *texture,
+			int	    unit,
+			int	    param)
+{
+    frostFunction    *function;
+    CompFunctionData *data;
+    int		     target;
+
+    FROST_SCREEN (s);
+
+    if (texture->target == GL_TEXTURE_2D)
+	target = COMP_FETCH_TARGET_2D;
+    else
+	target = COMP_FETCH_TARGET_RECT;
+
+    for (function = fs->iceFunctions; function; function = function->next)
+    {
+	if (function->param  == param &&
+	    function->unit   == unit  &&
+	    function->target == target)
+	    return function->handle;
+    }
+
+    data = createFunctionData ();
+    if (data)
+    {
+	static char *temp[] = { "ice", "temp" };
+	int	    i, handle = 0;
+	char	    str[1024];
+
+	for (i = 0; i < sizeof (temp) / sizeof (temp[0]); i++)
+	{
+	    if (!addTempHeaderOpToFunctionData (data, temp[i]))
+	    {
+		destroyFunctionData (data);
+		return 0;
+	    }
+	}
+
+	if (!addFetchOpToFunctionData (data, "output", NULL, target))
+	{
+	    destroyFunctionData (data);
+	    return 0;
+	}
+
+	snprintf (str, 1024,
+		  "TEX ice, fragment.texcoord[%d], texture[%d], %s;"
+		  "MUL ice, program.env[%d], ice.w;"
+		  "MUL ice, ice, output.w;"
+		  "SUB temp.w, 1.0, ice.w;"
+		  "MAD output, output, temp.w, ice;",
+		  unit, unit,
+		  (fs->target == GL_TEXTURE_2D) ? "2D" : "RECT",
+		  param);
+
+	if (!addDataOpToFunctionData (data, str))
+	{
+	    destroyFunctionData (data);
+	    return 0;
+	}
+
+	function = malloc (sizeof (frostFunction));
+	if (function)
+	{
+	    handle = createFragmentFunction (s, "frost_ice", data);
+
+	    function->handle = handle;
+	    function->target = target;
+	    function->param  = param;
+	    function->unit   = unit;
+
+	    function->heightOnly = FALSE;
+
+	    function->next = fs->iceFunctions;
+	    fs->iceFunctions = function;
+	}
+
+	destroyFunctionData (data);
+
+	return handle;
+    }
+
+    return 0;
+}
+
+static unsigned char *
+frostGetScratch (CompDisplay *d,
+		 int	     size)
+{
+    FROST_DISPLAY (d);
+
+    if (size > fd->scratchSize)
+    {
+	unsigned char *scratch;
+
+	scratch = realloc (fd->scratch, size);
+	if (!scratch)
+	    return NULL;
+
+	fd->scratch	= scratch;
+	fd->scratchSize = size;
+    }
+
+    return fd->scratch;
+}
+
+/* Return the memory the next normal map upload is written to. With pixel
+   buffer objects this is the mapped unpack buffer, orphaned first so the
+   driver never has to wait for the previous upload, otherwise it is the
+   display scratch buffer. */
+static unsigned char *
+frostMapUpload (CompScreen *s,
+		int	   size)
+{
+    unsigned char *buffer;
+
+    FROST_SCREEN (s);
+
+    fs->pboMapped = FALSE;
+
+    if (fs->mapBuffer)
+    {
+	if (!fs->pbo)
+	    (*fs->genBuffers) (1, &fs->pbo);
+
+	(*fs->bindBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB, fs->pbo);
+	(*fs->bufferData) (GL_PIXEL_UNPACK_BUFFER_ARB, size, NULL,
+			   GL_STREAM_DRAW_ARB);
+
+	buffer = (*fs->mapBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB,
+				   GL_WRITE_ONLY_ARB);
+	if (buffer)
+	{
+	    fs->pboMapped = TRUE;
+	    return buffer;
+	}
+
+	(*fs->bindBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+    }
+
+    return frostGetScratch (s->display, size);
+}
+
+/* finish writing to the upload buffer, returns the pixel pointer to pass
+   to glTexImage2D or NULL with nothing to upload */
+static const GLvoid *
+frostUnmapUpload (CompScreen	*s,
+		  unsigned char *buffer,
+		  Bool		*ok)
+{
+    FROST_SCREEN (s);
+
+    *ok = TRUE;
+
+    if (!fs->pboMapped)
+	return buffer;
+
+    /* contents are undefined when the unmap fails, skip the upload */
+    if (!(*fs->unmapBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB))
+	*ok = FALSE;
+
+    /* an offset into the bound unpack buffer */
+    return NULL;
+}
+
+static void
+frostDoneUpload (CompScreen *s)
+{
+    FROST_SCREEN (s);
+
+    if (fs->pboMapped)
+    {
+	(*fs->bindBuffer) (GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	fs->pboMapped = FALSE;
+    }
+}
+
 static void
 allocTexture (CompScreen *s,
+	      frostGrid  *g,
 	      int	 index)
 {
+    unsigned char *t0;
+    int		  i;
+
     FROST_SCREEN (s);
 
-    glGenTextures (1, &fs->texture[index]);
-    glBindTexture (fs->target, fs->texture[index]);
+    /* start out with a flat normal map, the same texel the row
+       encoders produce for a zero gradient and height */
+    t0 = frostGetScratch (s->display, g->width * g->height * 4);
+    if (t0)
+    {
+	memset (t0, 0, g->width * g->height * 4);
+	for (i = 0; i < g->width * g->height; i++)
+	{
+	    t0[i * 4]	  = 0xff;
+	    t0[i * 4 + 1] = t0[i * 4 + 2] = 0x7f;
+	}
+    }
+
+    glGenTextures (1, &g->texture[index]);
+    glBindTexture (fs->target, g->texture[index]);
 
     glTexParameteri (fs->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri (fs->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -391,8 +940,8 @@ allocTexture (CompScreen *s,
     glTexImage2D (fs->target,
 		  0,
 		  GL_RGBA,
-		  fs->width,
-		  fs->height,
+		  g->width,
+		  g->height,
 		  0,
 		  GL_BGRA,
 
@@ -402,13 +951,14 @@ allocTexture (CompScreen *s,
 		  GL_UNSIGNED_BYTE,
 #endif
 
-		  fs->t0);
+		  t0);
 
     glBindTexture (fs->target, 0);
 }
 
 static int
 fboPrologue (CompScreen *s,
+	     frostGrid  *g,
 	     int	tIndex)
 {
     FROST_SCREEN (s);
@@ -416,14 +966,14 @@ fboPrologue (CompScreen *s,
     if (!fs->fbo)
 	return 0;
 
-    if (!fs->texture[tIndex])
-	allocTexture (s, tIndex);
+    if (!g->texture[tIndex])
+	allocTexture (s, g, tIndex);
 
     (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, fs->fbo);
 
     (*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
 				GL_COLOR_ATTACHMENT0_EXT,
-				fs->target, fs->texture[tIndex],
+				fs->target, g->texture[tIndex],
 				0);
 
     glDrawBuffer (GL_COLOR_ATTACHMENT0_EXT);
@@ -450,7 +1000,7 @@ fboPrologue (CompScreen *s,
 	}
     }
 
-    glViewport (0, 0, fs->width, fs->height);
+    glViewport (0, 0, g->width, g->height);
     glMatrixMode (GL_PROJECTION);
     glPushMatrix ();
     glLoadIdentity ();
@@ -490,29 +1040,33 @@ fboEpilogue (CompScreen *s)
 
 static int
 fboUpdate (CompScreen *s,
-	   float      dt,
+	   frostGrid  *g,
+	   float      speed,
 	   float      fade)
 {
     FROST_SCREEN (s);
 
-    if (!fboPrologue (s, TINDEX (fs, 1)))
+    if (!fs->program)
+	return 0;
+
+    if (!fboPrologue (s, g, TINDEX (g, 1)))
 	return 0;
 
-    if (!fs->texture[TINDEX (fs, 2)])
-	allocTexture (s, TINDEX (fs, 2));
+    if (!g->texture[TINDEX (g, 2)])
+	allocTexture (s, g, TINDEX (g, 2));
 
-    if (!fs->texture[TINDEX (fs, 0)])
-	allocTexture (s, TINDEX (fs, 0));
+    if (!g->texture[TINDEX (g, 0)])
+	allocTexture (s, g, TINDEX (g, 0));
 
     glEnable (fs->target);
 
     (*s->activeTexture) (GL_TEXTURE0_ARB);
-    glBindTexture (fs->target, fs->texture[TINDEX (fs, 2)]);
+    glBindTexture (fs->target, g->texture[TINDEX (g, 2)]);
 
     glTexParameteri (fs->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri (fs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     (*s->activeTexture) (GL_TEXTURE1_ARB);
-    glBindTexture (fs->target, fs->texture[TINDEX (fs, 0)]);
+    glBindTexture (fs->target, g->texture[TINDEX (g, 0)]);
     glTexParameteri (fs->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri (fs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
@@ -520,17 +1074,20 @@ fboUpdate (CompScreen *s,
     (*s->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, fs->program);
 
     (*s->programLocalParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 0,
-				   dt * K, fade, 1.0f, 1.0f);
+				   speed, fade, 1.0f, 1.0f);
+    (*s->programLocalParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 1,
+				   g->tx / g->width, g->ty / g->height,
+				   0.0f, 0.0f);
 
     glBegin (GL_QUADS);
 
     glTexCoord2f (0.0f, 0.0f);
     glVertex2f   (-1.0f, -1.0f);
-    glTexCoord2f (fs->tx, 0.0f);
+    glTexCoord2f (g->tx, 0.0f);
     glVertex2f   (1.0f, -1.0f);
-    glTexCoord2f (fs->tx, fs->ty);
+    glTexCoord2f (g->tx, g->ty);
     glVertex2f   (1.0f, 1.0f);
-    glTexCoord2f (0.0f, fs->ty);
+    glTexCoord2f (0.0f, g->ty);
     glVertex2f   (-1.0f, 1.0f);
 
     glEnd ();
@@ -550,36 +1107,49 @@ fboUpdate (CompScreen *s,
     fboEpilogue (s);
 
     /* increment texture index */
-    fs->tIndex = TINDEX (fs, 1);
+    g->tIndex = TINDEX (g, 1);
+
+    g->heightOnly = FALSE;
 
     return 1;
 }
 
+/* amp is NULL or holds the amplitude of every vertex, which GL then
+   interpolates along lines */
 static int
-fboVertices (CompScreen *s,
-	     GLenum     type,
-	     XPoint     *p,
-	     int	n,
-	     float	v)
+fboVertices (CompScreen  *s,
+	     frostGrid	 *g,
+	     GLenum	 type,
+	     XPoint	 *p,
+	     const float *amp,
+	     int	 n,
+	     float	 v)
 {
-    FROST_SCREEN (s);
+    float radius;
+
+    FROST_DISPLAY (s->display);
 
-    if (!fboPrologue (s, TINDEX (fs, 0)))
+    if (!fboPrologue (s, g, TINDEX (g, 0)))
 	return 0;
 
     glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_TRUE);
     glColor4f (1.0f, 1.0f, 1.0f, v);
 
-    glPointSize (3.0f);
-    glLineWidth (1.0f);
+    radius = fd->brush.radius;
+
+    glPointSize (2.0f * radius + 1.0f);
+    glLineWidth (MAX (2.0f * radius - 1.0f, 1.0f));
 
-    glScalef (1.0f / fs->width, 1.0f / fs->height, 1.0);
+    glScalef (1.0f / g->width, 1.0f / g->height, 1.0);
     glTranslatef (0.5f, 0.5f, 0.0f);
 
     glBegin (type);
 
     while (n--)
     {
+	if (amp)
+	    glColor4f (1.0f, 1.0f, 1.0f, *amp++);
+
 	glVertex2i (p->x, p->y);
 	p++;
     }
@@ -594,1049 +1164,4364 @@ fboVertices (CompScreen *s,
     return 1;
 }
 
-static void
-softwareUpdate (CompScreen *s,
-		float      dt,
-		float      fade)
+/* p holds pairs of points on the same row, each pair is filled as a one
+   cell high quad that covers both end cells, like frostRasterSpans */
+static int
+fboSpans (CompScreen *s,
+	  frostGrid  *g,
+	  XPoint     *p,
+	  int	     n,
+	  float	     v)
 {
-    float	   *dTmp;
-    int		   i, j;
-    float	   v0, v1, inv;
-    float	   accel, value;
-    unsigned char *t0, *t;
-    int		  dWidth, dHeight;
-    float	  *d01, *d10, *d11, *d12;
+    if (!fboPrologue (s, g, TINDEX (g, 0)))
+	return 0;
 
-    FROST_SCREEN (s);
+    glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_TRUE);
+    glColor4f (1.0f, 1.0f, 1.0f, v);
 
-    if (!fs->texture[TINDEX (fs, 0)])
-	allocTexture (s, TINDEX (fs, 0));
+    glScalef (1.0f / g->width, 1.0f / g->height, 1.0);
 
-    dt *= K * 2.0f;
-    fade *= 0.99f;
+    glBegin (GL_QUADS);
 
-    dWidth = fs->width + 2;
-    dHeight = fs->height + 2;
+    while (n > 1)
+    {
+	glVertex2i (p[0].x,	p[0].y);
+	glVertex2i (p[1].x + 1, p[0].y);
+	glVertex2i (p[1].x + 1, p[0].y + 1);
+	glVertex2i (p[0].x,	p[0].y + 1);
 
-#define D(d, j) (*((d) + (j)))
+	p += 2;
+	n -= 2;
+    }
 
-    d01 = ->d0 + dWidth;
-    d10 = fs->d1;
-    d11 = d10 + dWidth;
-    d12 = d11 + dWidth;
+    glEnd ();
 
-    for (i = 1; i < dHeight - 1; i++)
-    {
-	for (j = 1; j < dWidth - 1; j++)
-	{
-	    accel = dt * (D (d10, j)     +
-			  D (d12, j)     +
-			  D (d11, j - 1) +
-			  D (d11, j + 1) - 4.0f * D (d11, j));
+    glColor4usv (defaultColor);
+    glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-	    value = (2.0f * D (d11, j) - D (d01, j) + accel) * fade;
+    fboEpilogue (s);
 
-	    CLAMP (value, -1.0f, 1.0f);
+    return 1;
+}
 
-	    D (d01, j) = value;
-	}
+typedef void (*FrostNormalRowProc) (unsigned char *t,
+				    const float	  *d10,
+				    const float	  *d11,
+				    const float	  *d12,
+				    int		  width,
+				    float	  scale);
 
-	d01 += dWidth;
-	d10 += dWidth;
-	d11 += dWidth;
-	d12 += dWidth;
-    }
+/* encode one row of the normal map, d11 is the row itself and d10, d12
+   the rows above and below */
+static void
+normalRowExact (unsigned char *t,
+		const float   *d10,
+		const float   *d11,
+		const float   *d12,
+		int	      width,
+		float	      scale)
+{
+    float v0, v1, inv;
+    int	  j;
 
-    /* update border */
-    memcpy (fs->d0, fs->d0 + dWidth, dWidth * sizeof (GLfloat));
-    memcpy (fs->d0 + dWidth * (dHeight - 1),
-	    fs->d0 + dWidth * (dHeight - 2),
-	    dWidth * sizeof (GLfloat));
+    for (j = 0; j < width; j++, t += 4)
+    {
+	v0 = (d12[j]	 - d10[j])     * scale;
+	v1 = (d11[j - 1] - d11[j + 1]) * scale;
 
-    d01 = fs->d0 + dWidth;
+	/* 0.5 for scale */
+	inv = 0.5f / sqrtf (v0 * v0 + v1 * v1 + 1.0f);
 
-    for (i = 1; i < dHeight - 1; i++)
-    {
-	D (d01, 0)	    = D (d01, 1);
-	D (d01, dWidth - 1) = D (d01, dWidth - 2);
+	/* add scale and bias to normal */
+	v0 = v0 * inv + 0.5f;
+	v1 = v1 * inv + 0.5f;
 
-	d01 += dWidth;
+	/* store normal map in RGB components */
+	t[0] = (unsigned char) ((inv + 0.5f) * 255.0f);
+	t[1] = (unsigned char) (v1 * 255.0f);
+	t[2] = (unsigned char) (v0 * 255.0f);
 
+	/* store height in A component */
+	t[3] = (unsigned char) (d11[j] * 255.0f);
     }
+}
 
-    d01 = fs->d0 + dWidth;
-    d10 = fs->d1;
-    d11 = d10 + dWidth;
-    d12 = d11 + dWidth;
-
-    t0 = fs->t0;
+/* one table lookup per texel, gradients are rounded to the table step
+   and clamped to its range */
+static void
+normalRowTable (unsigned char	    *t,
+		const float	    *d10,
+		const float	    *d11,
+		const float	    *d12,
+		int		    width,
+		float		    scale,
+		const unsigned char *table)
+{
+    const float	       bias = NORMAL_TABLE_SIZE / 2 + 0.5f;
+    const unsigned char *n;
+    int		       i0, i1, j;
 
-    /* update texture */
-    for (i = 0; i < fs->height; i++)
+    for (j = 0; j < width; j++, t += 4)
     {
-	for (j = 0; j < fs->width; j++)
-	{
-	d01 += dWidth;
-	d10 += dWidth;
-	d11 += dWidth;
-	d12 += dWidth;
-    }
-	   
-	    v0 = (D (d12, j)     - D (d10, j))     * 1.5f;
-	    v1 = (D (d11, j - 1) - D (d11, j + 1)) * 1.5f;
-
-	    /* 0.5 for scale */
-	    inv = 0.5f / sqrtf (v0 * v0 + v1 * v1 + 1.0f);
-
-	    /* add scale and bias to normal */
-	    v0 = v0 * inv + 0.5f;
-	    v1 = v1 * inv + 0.5f;
-
-	    /* store normal map in RGB components */
-	    t = t0 + (j * 4);
-	    t[0] = (unsigned char) ((inv + 0.5f) * 255.0f);
-	    t[1] = (unsigned char) (v1 * 255.0f);
-	    t[2] = (unsigned char) (v0 * 255.0f);
+	i0 = (int) ((d12[j] - d10[j]) * scale * NORMAL_TABLE_SCALE + bias);
+	i1 = (int) ((d11[j - 1] - d11[j + 1]) * scale * NORMAL_TABLE_SCALE +
+		    bias);
 
-	    /* store height in A component */
-	    t[3] = (unsigned char) (D (d11, j) * 255.0f);
-	}
+	CLAMP (i0, 0, NORMAL_TABLE_SIZE - 1);
+	CLAMP (i1, 0, NORMAL_TABLE_SIZE - 1);
 
-	d10 += dWidth;
-	d11 += dWidth;
-	d12 += dWidth;
+	n = table + ((i0 << NORMAL_TABLE_BITS) + i1) * 4;
 
-	t0 += fs->width * 4;
+	t[0] = n[0];
+	t[1] = n[1];
+	t[2] = n[2];
+	t[3] = (unsigned char) (d11[j] * 255.0f);
     }
+}
 
-#undef D
-
-    /* swap height maps */
-    dTmp   = fs->d0;
-    fs->d0 = fs->d1;
-    fs->d1 = dTmp;
-
-    if (fs->texture[TINDEX (fs, 0)])
+#if defined (__SSE2__) && IMAGE_BYTE_ORDER != MSBFirst
+/* Four texels at a time, the hardware reciprocal square root estimate is
+   refined by one Newton step and the channels are clamped and interleaved
+   with saturating packs. Differs from the exact row by at most one step
+   in the normal channels, heights below zero are stored as 0. */
+static void
+normalRowFast (unsigned char *t,
+	       const float   *d10,
+	       const float   *d11,
+	       const float   *d12,
+	       int	     width,
+	       float	     gradientScale)
+{
+    const __m128 scale = _mm_set1_ps (gradientScale);
+    const __m128 half  = _mm_set1_ps (0.5f);
+    const __m128 three = _mm_set1_ps (3.0f);
+    const __m128 one   = _mm_set1_ps (1.0f);
+    const __m128 max   = _mm_set1_ps (255.0f);
+    __m128	 v0, v1, s, r, b, g, a;
+    __m128i	 br, ga, x;
+    int		 j;
+
+    for (j = 0; j + 4 <= width; j += 4, t += 16)
     {
-	glBindTexture (fs->target, fs->texture[TINDEX (fs, 0)]);
-	glTexImage2D (fs->target,
-		      0,
-		      GL_RGBA,
-		      fs->width,
-		      fs->height,
-		      0,
-		      GL_BGRA,
+	v0 = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (d12 + j),
+				     _mm_loadu_ps (d10 + j)), scale);
+	v1 = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (d11 + j - 1),
+				     _mm_loadu_ps (d11 + j + 1)), scale);
+
+	s = _mm_add_ps (_mm_add_ps (_mm_mul_ps (v0, v0),
+				    _mm_mul_ps (v1, v1)), one);
+
+	/* r = r * (3 - s * r * r) / 2, folded with the 0.5 for scale */
+	r = _mm_rsqrt_ps (s);
+	r = _mm_mul_ps (_mm_mul_ps (r, _mm_set1_ps (0.25f)),
+			_mm_sub_ps (three, _mm_mul_ps (s, _mm_mul_ps (r, r))));
+
+	b  = _mm_mul_ps (_mm_add_ps (r, half), max);
+	g  = _mm_mul_ps (_mm_add_ps (_mm_mul_ps (v1, r), half), max);
+	v0 = _mm_mul_ps (_mm_add_ps (_mm_mul_ps (v0, r), half), max);
+	a  = _mm_mul_ps (_mm_loadu_ps (d11 + j), max);
+
+	/* B0-3 R0-3 G0-3 A0-3 saturated to bytes */
+	br = _mm_packs_epi32 (_mm_cvttps_epi32 (b), _mm_cvttps_epi32 (v0));
+	ga = _mm_packs_epi32 (_mm_cvttps_epi32 (g), _mm_cvttps_epi32 (a));
+	x  = _mm_packus_epi16 (br, ga);
+
+	/* interleave to B G R A per texel */
+	x = _mm_unpacklo_epi8 (x, _mm_srli_si128 (x, 8));
+	x = _mm_unpacklo_epi16 (x, _mm_srli_si128 (x, 8));
+
+	_mm_storeu_si128 ((__m128i *) t, x);
+    }
 
-#if IMAGE_BYTE_ORDER == MSBFirst
-		  GL_UNSIGNED_INT_8_8_8_8_REV,
+    if (j < width)
+	normalRowExact (t, d10 + j, d11 + j, d12 + j, width - j,
+			gradientScale);
+}
 #else
-		  GL_UNSIGNED_BYTE,
+#define normalRowFast normalRowExact
 #endif
 
-		      fs->t0);
-    }
-}
+static unsigned char *
+frostGetNormalTable (CompDisplay *d)
+{
+    unsigned char *n;
+    float	  v0, v1, inv;
+    int		  i0, i1;
 
+    FROST_DISPLAY (d);
 
-#define SET(x, y, v) *((fs->d1) + (fs->width + 2) * (y + 1) + (x + 1)) = (v)
+    if (fd->normalTable)
+	return fd->normalTable;
 
-static void
-softwarePoints (CompScreen *s,
-		XPoint	   *p,
-		int	   n,
-		float	   add)
-{
-    FROST_SCREEN (s);
+    n = malloc (NORMAL_TABLE_SIZE * NORMAL_TABLE_SIZE * 4);
+    if (!n)
+	return NULL;
 
-    while (n--)
+    fd->normalTable = n;
+
+    /* same encoding as normalRowExact */
+    for (i0 = 0; i0 < NORMAL_TABLE_SIZE; i0++)
     {
-	SET (p->x - 1, p->y - 1, add);
-	SET (p->x, p->y - 1, add);
-	SET (p->x + 1, p->y - 1, add);
+	v0 = (i0 - NORMAL_TABLE_SIZE / 2) / NORMAL_TABLE_SCALE;
 
-	SET (p->x - 1, p->y, add);
-	SET (p->x, p->y, add);
-	SET (p->x + 1, p->y, add);
+	for (i1 = 0; i1 < NORMAL_TABLE_SIZE; i1++, n += 4)
+	{
+	    v1 = (i1 - NORMAL_TABLE_SIZE / 2) / NORMAL_TABLE_SCALE;
 
-	SET (p->x - 1, p->y + 1, add);
-	SET (p->x, p->y + 1, add);
-	SET (p->x + 1, p->y + 1, add);
+	    inv = 0.5f / sqrtf (v0 * v0 + v1 * v1 + 1.0f);
 
-	p++;
+	    n[0] = (unsigned char) ((inv + 0.5f) * 255.0f);
+	    n[1] = (unsigned char) ((v1 * inv + 0.5f) * 255.0f);
+	    n[2] = (unsigned char) ((v0 * inv + 0.5f) * 255.0f);
+	    n[3] = 0;
+	}
     }
+
+    return fd->normalTable;
 }
 
-/* bresenham */
+/* take one step, the normal map is encoded and uploaded only with
+   upload set */
 static void
-softwareLines (CompScreen *s,
-	       XPoint	  *p,
-	       int	  n,
-	       float	  v)
+softwareUpdate (CompScreen *s,
+		frostGrid  *g,
+		float      speed,
+		float      fade,
+		Bool	   upload)
 {
-    int	 x1, y1, x2, y2;
-    Bool steep;
-    int  tmp;
-    int  deltaX, deltaY;
-    int  error = 0;
-    int  yStep;
-    int  x, y;
+    float	   *dTmp;
+    int		   i, j;
+    float	   accel, value, height;
+    unsigned char *buffer, *t0, *h;
+    const GLvoid  *pixels;
+    int		  pitch;
+    Bool	  ok;
+    float	  *d01, *d10, *d11, *d12;
+    FrostNormalRowProc normalRow;
+    unsigned char      *table = NULL;
 
     FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
 
-#define SWAP(v0, v1) \
-    tmp = v0;	     \
-    v0 = v1;	     \
-    v1 = tmp
+    if (!g->texture[TINDEX (g, 0)])
+	allocTexture (s, g, TINDEX (g, 0));
 
-    while (n > 1)
-    {
-	x1 = p->x;
-	y1 = p->y;
+    g->heightOnly = fd->opt[FROST_DISPLAY_OPTION_HEIGHT_ONLY].value.b;
 
-	p++;
-	n--;
+    buffer = h = NULL;
 
-	x2 = p->x;
-	y2 = p->y;
+    /* the normal map is written straight into the upload buffer */
+    if (upload)
+    {
+	buffer = frostMapUpload (s, g->width * g->height *
+				 (g->heightOnly ? 1 : 4));
+	if (!buffer)
+	    return;
+
+	/* when only heights are uploaded they are stored biased to 0..255,
+	   taken from the same field the normal map encodes below */
+	if (g->heightOnly)
+	    h = buffer;
+    }
 
-	p++;
-	n--;
+    pitch = g->pitch;
 
-	steep = abs (y2 - y1) > abs (x2 - x1);
-	if (steep)
-	{
-	    SWAP (x1, y1);
-	    SWAP (x2, y2);
-	}
+#define D(d, j) (*((d) + (j)))
+
+    d01 = g->d0 + pitch + 1;
+    d10 = g->d1 + 1;
+    d11 = d10 + pitch;
+    d12 = d11 + pitch;
 
-	if (x1 > x2)
+    for (i = 0; i < g->height; i++)
+    {
+	for (j = 0; j < g->width; j++)
 	{
-	    SWAP (x1, x2);
-	    SWAP (y1, y2);
-	}
+	    accel = speed * (D (d10, j)     +
+			     D (d12, j)     +
+			     D (d11, j - 1) +
+			     D (d11, j + 1) - 4.0f * D (d11, j));
 
-#undef SWAP
+	    value = (2.0f * D (d11, j) - D (d01, j) + accel) * fade;
 
-	deltaX = x2 - x1;
-	deltaY = abs (y2 - y1);
+	    CLAMP (value, -1.0f, 1.0f);
 
-	y = y1;
-	if (y1 < y2)
-	    yStep = 1;
-	else
-	    yStep = -1;
+	    D (d01, j) = value;
 
-	for (x = x1; x <= x2; x++)
-	{
-	    if (steep)
-	    {
-		SET (y, x, v);
-	    }
-	    else
+	    if (h)
 	    {
-		SET (x, y, v);
-	    }
+		height = D (d11, j);
 
-	    error += deltaY;
-	    if (2 * error >= deltaX)
-	    {
-		y += yStep;
-		error -= deltaX;
+		CLAMP (height, -1.0f, 1.0f);
+
+		h[j] = (unsigned char) ((height * 0.5f + 0.5f) * 255.0f + 0.5f);
 	    }
 	}
-    }
-}
 
-#undef SET
+	if (h)
+	    h += g->width;
 
-static void
-softwareVertices (CompScreen *s,
-		  GLenum     type,
-		  XPoint     *p,
-		  int	     n,
-		  float	     v)
-{
-    switch (type) {
-    case GL_POINTS:
-	softwarePoints (s, p, n, v);
-	break;
-    case GL_LINES:
-	softwareLines (s, p, n, v);
-	break;
+	d01 += pitch;
+	d10 += pitch;
+	d11 += pitch;
+	d12 += pitch;
     }
-}
 
-static void
-frostUpdate (CompScreen *s,
-	     float	dt)
-{
-    GLfloat fade = 1.0f;
+    /* update border */
+    memcpy (g->d0, g->d0 + pitch, (g->width + 2) * sizeof (GLfloat));
+    memcpy (g->d0 + pitch * (g->height + 1),
+	    g->d0 + pitch * g->height,
+	    (g->width + 2) * sizeof (GLfloat));
 
-    FROST_SCREEN (s);
+    d01 = g->d0 + pitch;
 
-    if (fs->count < 1000)
+    for (i = 0; i < g->height; i++)
     {
-	if (fs->count > 1)
-	    fade = 0.90f + fs->count / 10000.0f;
-	else
-	    fade = 0.0f;
+	D (d01, 0)	      = D (d01, 1);
+	D (d01, g->width + 1) = D (d01, g->width);
+
+	d01 += pitch;
     }
 
-    if (!fboUpdate (s, dt, fade))
-	softwareUpdate (s, dt, fade);
-}
+    if (upload && !g->heightOnly)
+    {
+	d10 = g->d1 + 1;
+	d11 = d10 + pitch;
+	d12 = d11 + pitch;
+
+	t0 = buffer;
+
+	switch (fd->opt[FROST_DISPLAY_OPTION_NORMAL_MODE].value.i) {
+	case NORMAL_MODE_TABLE:
+	    table = frostGetNormalTable (s->display);
+	    /* fall-through */
+	case NORMAL_MODE_FAST:
+	    normalRow = normalRowFast;
+	    break;
+	default:
+	    normalRow = normalRowExact;
+	    break;
+	}
 
-static void
-scaleVertices (CompScreen *s,
-	       XPoint	  *p,
-	       int	  n)
-{
-    FROST_SCREEN (s);
+	/* update texture */
+	for (i = 0; i < g->height; i++)
+	{
+	    if (table)
+		normalRowTable (t0, d10, d11, d12, g->width, fd->normalScale,
+				table);
+	    else
+		(*normalRow) (t0, d10, d11, d12, g->width, fd->normalScale);
 
-    while (n--)
-    {
-	p[n].x = (fs->width  * p[n].x) / s->width;
-	p[n].y = (fs->height * p[n].y) / s->height;
+	    d10 += pitch;
+	    d11 += pitch;
+	    d12 += pitch;
+
+	    t0 += g->width * 4;
+	}
     }
-}
 
-static void
-frostVertices (CompScreen *s,
-	       GLenum     type,
-	       XPoint     *p,
-	       int	  n,
-	       float	  v)
-{
-    FROST_SCREEN (s);
+#undef D
 
-    if (!s->fragmentProgram)
+    /* swap height maps */
+    dTmp  = g->d0;
+    g->d0 = g->d1;
+    g->d1 = dTmp;
+
+    if (!upload)
 	return;
 
-    scaleVertices (s, p, n);
+    pixels = frostUnmapUpload (s, buffer, &ok);
+
+    if (ok && g->texture[TINDEX (g, 0)] && g->heightOnly)
+    {
+	glBindTexture (fs->target, g->texture[TINDEX (g, 0)]);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D (fs->target,
+		      0,
+		      GL_ALPHA8,
+		      g->width,
+		      g->height,
+		      0,
+		      GL_ALPHA,
+		      GL_UNSIGNED_BYTE,
+		      pixels);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+    }
+    else if (ok && g->texture[TINDEX (g, 0)])
+    {
+	glBindTexture (fs->target, g->texture[TINDEX (g, 0)]);
+	glTexImage2D (fs->target,
+		      0,
+		      GL_RGBA,
+		      g->width,
+		      g->height,
+		      0,
+		      GL_BGRA,
+
+#if IMAGE_BYTE_ORDER == MSBFirst
+		  GL_UNSIGNED_INT_8_8_8_8_REV,
+#else
+		  GL_UNSIGNED_BYTE,
+#endif
 
-    if (!fboVertices (s, type, p, n, v))
-	softwareVertices (s, type, p, n, v);
+		      pixels);
+    }
 
-    if (fs->count < 3000)
-	fs->count = 3000;
+    frostDoneUpload (s);
 }
 
-static Bool
-frostRainTimeout (void *closure)
-{
-    CompScreen *s = closure;
-    XPoint     p;
 
-    p.x = (int) (s->width  * (rand () / (float) RAND_MAX));
-    p.y = (int) (s->height * (rand () / (float) RAND_MAX));
+/* the heights the software path writes to and the output they cover */
+static void
+frostGridField (frostGrid  *g,
+		FrostField *f)
+{
+    f->d      = g->d1 + g->pitch + 1;
+    f->width  = g->width;
+    f->height = g->height;
+    f->pitch  = g->pitch;
+
+    f->x	    = g->x;
+    f->y	    = g->y;
+    f->outputWidth  = g->outputWidth;
+    f->outputHeight = g->outputHeight;
+}
 
-    frostVertices (s, GL_POINTS, &p, 1, 0.8f * (rand () / (float) RAND_MAX));
+/* cheap per cell noise for the growth rule */
+static unsigned int
+iceHash (unsigned int x,
+	 unsigned int y,
+	 unsigned int step)
+{
+    unsigned int h;
 
-    damageScreen (s);
+    h  = x * 73856093u ^ y * 19349663u ^ step * 83492791u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
 
-    return TRUE;
+    return h;
 }
 
 static Bool
-frostWiperTimeout (void *closure)
+frostInitIce (frostGrid *g)
 {
-    CompScreen *s = closure;
+    int x, y;
 
-    FROST_SCREEN (s);
+    g->iceTilesX = (g->width  + ICE_TILE - 1) / ICE_TILE;
+    g->iceTilesY = (g->height + ICE_TILE - 1) / ICE_TILE;
 
-    if (fs->count)
+    g->ice	= calloc (g->width * g->height, 1);
+    g->iceTiles = calloc (g->iceTilesX * g->iceTilesY, 1);
+    if (!g->ice || !g->iceTiles)
     {
-	if (fs->wiperAngle == 0.0f)
-	    fs->wiperSpeed = 2.5f;
-	else if (fs->wiperAngle == 180.0f)
-	    fs->wiperSpeed = -2.5f;
+	free (g->ice);
+	free (g->iceTiles);
+
+	g->ice	    = NULL;
+	g->iceTiles = NULL;
+
+	return FALSE;
+    }
+
+    /* ice starts growing in from the edges */
+    g->iceActive = 0;
+    for (y = 0; y < g->iceTilesY; y++)
+    {
+	for (x = 0; x < g->iceTilesX; x++)
+	{
+	    if (x && y && x < g->iceTilesX - 1 && y < g->iceTilesY - 1)
+		continue;
+
+	    g->iceTiles[y * g->iceTilesX + x] = ICE_TILE_ACTIVE;
+	    g->iceActive++;
+	}
     }
 
+    g->iceStep = 0;
+    g->iceY0   = 0;
+    g->iceY1   = g->height;
+
+    g->iceDamageY0 = 0;
+    g->iceDamageY1 = g->height;
+
     return TRUE;
 }
 
 static void
-frostReset (CompScreen *s)
+frostFiniIce (frostGrid *g)
 {
-    int size, i, j;
+    if (g->iceTexture)
+	glDeleteTextures (1, &g->iceTexture);
 
-    FROST_SCREEN (s);
-
-    fs->height = TEXTURE_SIZE;
-    fs->width  = (fs->height * s->width) / s->height;
+    free (g->ice);
+    free (g->iceTiles);
 
-    if (s->textureNonPowerOfTwo ||
-	(POWER_OF_TWO (fs->width) && POWER_OF_TWO (fs->height)))
-    {
-	fs->target = GL_TEXTURE_2D;
-	fs->tx = fs->ty = 1.0f;
-    }
-    else
-    {
-	fs->target = GL_TEXTURE_RECTANGLE_NV;
-	fs->tx = fs->width;
-	fs->ty = fs->height;
-    }
+    g->iceTexture = 0;
+    g->ice	  = NULL;
+    g->iceTiles	  = NULL;
+    g->iceActive  = 0;
 
-    if (!s->fragmentProgram)
-	return;
+    g->iceDamageY0 = 0;
+    g->iceDamageY1 = g->height;
+}
 
-    if (s->fbo)
-    {
-	loadfrostProgram (s);
-	if (!fs->fbo)
-	    (*s->genFramebuffers) (1, &fs->fbo);
-    }
+/* wake the tiles covering cells x0..x1, y0..y1 and their neighbours and
+   remember the rows for upload */
+static void
+frostTouchIce (frostGrid *g,
+	       int	 x0,
+	       int	 y0,
+	       int	 x1,
+	       int	 y1,
+	       int	 flag)
+{
+    unsigned char *t;
+    int		  tx, ty, tx0, ty0, tx1, ty1;
 
-    fs->fboStatus = 0;
+    tx0 = MAX (x0 / ICE_TILE - 1, 0);
+    ty0 = MAX (y0 / ICE_TILE - 1, 0);
+    tx1 = MIN (x1 / ICE_TILE + 1, g->iceTilesX - 1);
+    ty1 = MIN (y1 / ICE_TILE + 1, g->iceTilesY - 1);
 
-    for (i = 0; i < TEXTURE_NUM; i++)
+    for (ty = ty0; ty <= ty1; ty++)
     {
-	if (fs->texture[i])
+	t = g->iceTiles + ty * g->iceTilesX;
+
+	for (tx = tx0; tx <= tx1; tx++)
 	{
-	    glDeleteTextures (1, &fs->texture[i]);
-	    fs->texture[i] = 0;
+	    if (!(t[tx] & flag) && flag == ICE_TILE_ACTIVE)
+		g->iceActive++;
+
+	    t[tx] |= flag;
 	}
     }
 
-    if (fs->data)
-	free (fs->data);
+    g->iceY0 = MIN (g->iceY0, y0);
+    g->iceY1 = MAX (g->iceY1, y1 + 1);
+}
 
-    size = (fs->width + 2) * (fs->height + 2);
+/* grow one tile, returns TRUE when any cell froze further and sets
+   pending while cells touching ice are left to grow */
+static Bool
+frostGrowIceTile (frostGrid *g,
+		  int	    tx,
+		  int	    ty,
+		  Bool	    *pending)
+{
+    unsigned char *c;
+    int		  x, y, x0, y0, x1, y1, k, w, chance;
+    Bool	  changed = FALSE;
 
-    fs->data = calloc (1, (sizeof (float) * size * 2) +
-		       (sizeof (GLubyte) * fs->width * fs->height * 4));
-    if (!fs->data)
-	return;
+    w = g->width;
 
-    fs->d0 = fs->data;
-    fs->d1 = (fs->d0 + (size));
-    fs->t0 = (unsigned char *) (fs->d1 + (size));
+    x0 = tx * ICE_TILE;
+    y0 = ty * ICE_TILE;
+    x1 = MIN (x0 + ICE_TILE, g->width);
+    y1 = MIN (y0 + ICE_TILE, g->height);
 
-    for (i = 0; i < fs->height; i++)
+    for (y = y0; y < y1; y++)
     {
-	for (j = 0; j < fs->width; j++)
+	c = g->ice + y * w;
+
+	for (x = x0; x < x1; x++)
 	{
-	    (fs->t0 + (fs->width * 4 * i + j * 4))[0] = 0xff;
+	    if (c[x] == 255)
+		continue;
+
+	    /* frozen neighbours, outside the grid counts as frozen */
+	    k  = (y == 0	     || c[x - w] == 255);
+	    k += (y == g->height - 1 || c[x + w] == 255);
+	    k += (x == 0	     || c[x - 1] == 255);
+	    k += (x == w - 1	     || c[x + 1] == 255);
+
+	    if (!k)
+		continue;
+
+	    *pending = TRUE;
+
+	    chance = (k == 1) ? ICE_TIP_CHANCE : ICE_FILL_CHANCE;
+	    if ((iceHash (x, y, g->iceStep) & 0xff) >= chance)
+		continue;
+
+	    c[x] = MIN (c[x] + ICE_GROW_STEP, 255);
+	    changed = TRUE;
 	}
     }
+
+    return changed;
 }
 
+/* advance the ice by one step, visiting active tiles only */
 static void
-frostDrawWindowTexture (CompWindow	     *w,
-			CompTexture	     *texture,
-			const FragmentAttrib *attrib,
-			unsigned int	     mask)
+frostIceStep (frostGrid *g)
 {
-    FROST_SCREEN (w->screen);
+    unsigned char *t;
+    unsigned int  h;
+    int		  tx, ty, x, y, i, n;
+    Bool	  pending;
+
+    g->iceStep++;
 
-    if (fs->count)
+    /* the occasional seed away from the edges */
+    h = iceHash (g->iceStep, 0, 0x9e3779b9u);
+    if ((h & 0xff) < ICE_SEED_CHANCE)
     {
-	FragmentAttrib fa = *attrib;
-	Bool	       lighting = w->screen->lighting;
-	int	       param, function, unit;
-	GLfloat	       plane[4];
+	x = (h >> 8) % g->width;
+	y = iceHash (g->iceStep, 1, 0x9e3779b9u) % g->height;
 
-	FROST_DISPLAY (w->screen->display);
+	if (g->ice[y * g->width + x] != 255)
+	{
+	    g->ice[y * g->width + x] = 255;
+	    frostTouchIce (g, x, y, x, y, ICE_TILE_NEXT);
+	}
+    }
 
-	param = allocFragmentParameters (&fa, 1);
-	unit  = allocFragmentTextureUnits (&fa, 1);
+    for (ty = 0; ty < g->iceTilesY; ty++)
+    {
+	t = g->iceTiles + ty * g->iceTilesX;
 
-	function = getBumpMapFragmentFunction (w->screen, texture, unit, param);
-	if (function)
+	for (tx = 0; tx < g->iceTilesX; tx++)
 	{
-	    addFragmentFunction (&fa, function);
-
-	    screenLighting (w->screen, TRUE);
+	    if (!(t[tx] & ICE_TILE_ACTIVE))
+		continue;
+
+	    pending = FALSE;
+
+	    if (frostGrowIceTile (g, tx, ty, &pending))
+		frostTouchIce (g,
+			       tx * ICE_TILE, ty * ICE_TILE,
+			       MIN ((tx + 1) * ICE_TILE, g->width) - 1,
+			       MIN ((ty + 1) * ICE_TILE, g->height) - 1,
+			       ICE_TILE_NEXT);
+	    else if (pending)
+		t[tx] |= ICE_TILE_NEXT;
+	}
+    }
 
-	    (*w->screen->activeTexture) (GL_TEXTURE0_ARB + unit);
+    n = g->iceTilesX * g->iceTilesY;
 
-	    glBindTexture (fs->target, fs->texture[TINDEX (fs, 0)]);
+    g->iceActive = 0;
+    for (i = 0; i < n; i++)
+    {
+	g->iceTiles[i] = (g->iceTiles[i] & ICE_TILE_NEXT) ? ICE_TILE_ACTIVE : 0;
+	if (g->iceTiles[i])
+	    g->iceActive++;
+    }
+}
 
-	    plane[1] = plane[2] = 0.0f;
-	    plane[0] = fs->tx / (GLfloat) w->screen->width;
-	    plane[3] = 0.0f;
+static void
+frostMeltDisc (frostGrid *g,
+	       int	 cx,
+	       int	 cy,
+	       int	 r)
+{
+    unsigned char *c;
+    int		  x, y, x0, y0, x1, y1;
+    Bool	  melted = FALSE;
 
-	    glTexGeni (GL_S, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
-	    glTexGenfv (GL_S, GL_EYE_PLANE, plane);
-	    glEnable (GL_TEXTURE_GEN_S);
+    x0 = MAX (cx - r, 0);
+    y0 = MAX (cy - r, 0);
+    x1 = MIN (cx + r, g->width - 1);
+    y1 = MIN (cy + r, g->height - 1);
 
-	    plane[0] = plane[2] = 0.0f;
-	    plane[1] = fs->ty / (GLfloat) w->screen->height;
-	    plane[3] = 0.0f;
+    for (y = y0; y <= y1; y++)
+    {
+	c = g->ice + y * g->width;
 
-	    glTexGeni (GL_T, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
-	    glTexGenfv (GL_T, GL_EYE_PLANE, plane);
-	    glEnable (GL_TEXTURE_GEN_T);
+	for (x = x0; x <= x1; x++)
+	{
+	    if (c[x] && (x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+	    {
+		c[x]   = 0;
+		melted = TRUE;
+	    }
+	}
+    }
 
-	    (*w->screen->activeTexture) (GL_TEXTURE0_ARB);
+    if (melted)
+	frostTouchIce (g, x0, y0, x1, y1, ICE_TILE_ACTIVE);
+}
 
-	    (*w->screen->programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB, param,
-						 texture->matrix.yy *
-						 fd->offsetScale,
-						 -texture->matrix.xx *
-						 fd->offsetScale,
-						 0.0f, 0.0f);
-	}
+/* melt the ice under clipped points and lines */
+static void
+frostMeltVertices (CompScreen *s,
+		   frostGrid  *g,
+		   GLenum     type,
+		   XPoint     *p,
+		   int	      n)
+{
+    int r, i, j, steps;
 
-	/* to get appropriate filtering of texture */
-	mask |= PAINT_WINDOW_ON_TRANSFORMED_SCREEN_MASK;
+    FROST_DISPLAY (s->display);
 
-	UNWRAP (fs, w->screen, drawWindowTexture);
-	(*w->screen->drawWindowTexture) (w, texture, &fa, mask);
-	WRAP (fs, w->screen, drawWindowTexture, frostDrawWindowTexture);
+    r = fd->brush.extent + ICE_MELT_EXTRA;
 
-	if (function)
+    switch (type) {
+    case GL_POINTS:
+	for (i = 0; i < n; i++)
+	    frostMeltDisc (g, p[i].x, p[i].y, r);
+	break;
+    case GL_LINES:
+	for (i = 0; i + 1 < n; i += 2)
 	{
-	    (*w->screen->activeTexture) (GL_TEXTURE0_ARB + unit);
-	    glDisable (GL_TEXTURE_GEN_T);
-	    glDisable (GL_TEXTURE_GEN_S);
-	    glBindTexture (fs->target, 0);
-	    (*w->screen->activeTexture) (GL_TEXTURE0_ARB);
-
-	    screenLighting (w->screen, lighting);
+	    steps = MAX (abs (p[i + 1].x - p[i].x), abs (p[i + 1].y - p[i].y));
+	    steps = MAX (steps / MAX (r, 1), 1);
+
+	    for (j = 0; j <= steps; j++)
+		frostMeltDisc (g,
+			       p[i].x + (p[i + 1].x - p[i].x) * j / steps,
+			       p[i].y + (p[i + 1].y - p[i].y) * j / steps,
+			       r);
 	}
+	break;
+    default:
+	break;
     }
-    else
+}
+
+/* melt the ice under the spans the wiper swept */
+static void
+frostMeltSpans (frostGrid *g,
+		XPoint	  *p,
+		int	  n)
+{
+    int i, y0 = g->height, y1 = -1;
+
+    for (i = 0; i + 1 < n; i += 2)
     {
-	UNWRAP (fs, w->screen, drawWindowTexture);
-	(*w->screen->drawWindowTexture) (w, texture, attrib, mask);
-	WRAP (fs, w->screen, drawWindowTexture, frostDrawWindowTexture);
+	memset (g->ice + p[i].y * g->width + p[i].x, 0,
+		p[i + 1].x - p[i].x + 1);
+
+	y0 = MIN (y0, p[i].y);
+	y1 = MAX (y1, p[i].y);
     }
+
+    if (y0 <= y1)
+	frostTouchIce (g, 0, y0, g->width - 1, y1, ICE_TILE_ACTIVE);
 }
 
-/* TODO: a way to control the speed */
+/* upload the rows of ice that changed */
 static void
-frostPreparePaintScreen (CompScreen *s,
-			 int	    msSinceLastPaint)
+frostUploadIce (CompScreen *s,
+		frostGrid  *g)
 {
     FROST_SCREEN (s);
 
-    if (fs->count)
-    {
-	fs->count -= 10;
-	if (fs->count < 0)
-	    fs->count = 0;
+    if (g->iceY0 >= g->iceY1)
+	return;
 
-	if (fs->wiperHandle)
-	{
-	    float  step, angle0, angle1;
-	    Bool   wipe = FALSE;
-	    XPoint p[3];
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
 
-	    p[1].x = s->width / 2;
-	    p[1].y = s->height;
+    if (!g->iceTexture)
+    {
+	glGenTextures (1, &g->iceTexture);
+	glBindTexture (fs->target, g->iceTexture);
 
-	    step = fs->wiperSpeed * msSinceLastPaint / 20.0f;
+	glTexParameteri (fs->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (fs->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (fs->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (fs->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	    if (fs->wiperSpeed > 0.0f)
-	    {
-		if (fs->wiperAngle < 180.0f)
-		{
-		    angle0 = fs->wiperAngle;
+	glTexImage2D (fs->target, 0, GL_ALPHA8, g->width, g->height, 0,
+		      GL_ALPHA, GL_UNSIGNED_BYTE, g->ice);
+    }
+    else
+    {
+	glBindTexture (fs->target, g->iceTexture);
+	glTexSubImage2D (fs->target, 0, 0, g->iceY0,
+			 g->width, g->iceY1 - g->iceY0,
+			 GL_ALPHA, GL_UNSIGNED_BYTE,
+			 g->ice + g->iceY0 * g->width);
+    }
 
-		    fs->wiperAngle += step;
-		    fs->wiperAngle = MIN (fs->wiperAngle, 180.0f);
+    glBindTexture (fs->target, 0);
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
 
-		    angle1 = fs->wiperAngle;
+    g->iceDamageY0 = MIN (g->iceDamageY0, g->iceY0);
+    g->iceDamageY1 = MAX (g->iceDamageY1, g->iceY1);
 
-		    wipe = TRUE;
-		}
-	    }
-	    else
-	    {
-		if (fs->wiperAngle > 0.0f)
-		{
-		    angle1 = fs->wiperAngle;
+    g->iceY0 = g->height;
+    g->iceY1 = 0;
+}
 
-		    fs->wiperAngle += step;
-		    fs->wiperAngle = MAX (fs->wiperAngle, 0.0f);
+/* cotangent of an angle in degrees, large but finite at 0 and 180 */
+static float
+wiperCot (float angle)
+{
+    float c, sn;
 
-		    angle0 = fs->wiperAngle;
+    c  = cosf (angle * (M_PI / 180.0f));
+    sn = sinf (angle * (M_PI / 180.0f));
 
-		    wipe = TRUE;
-		}
-	    }
+    if (sn < 1e-6f)
+	return (c > 0.0f) ? 1e6f : -1e6f;
 
-#define TAN(a) (tanf ((a) * (M_PI / 180.0f)))
+    return c / sn;
+}
 
-	    if (wipe)
-	    {
-		if (angle0 > 0.0f)
-		{
-		    p[2].x = s->width / 2 - s->height / TAN (angle0);
-		    p[2].y = 0;
-		}
-		else
-		{
-		    p[2].x = 0;
-		    p[2].y = s->height;
-		}
+/* Flatten the sector the wiper blade swept since the last step. The blade
+   pivots at the bottom center of the grid, so on a row dy cells above
+   the pivot the sector covers x in [px - dy * cot (a0), px - dy * cot (a1)].
+   Only rows where that span is on the grid are touched. */
+static void
+frostWipe (CompScreen *s,
+	   frostGrid  *g)
+{
+    FrostField f;
+    XPoint     *p;
+    float      cot0, cot1, px, dy, dyMax;
+    int	       x0, x1, y, yMin, n = 0;
 
-		if (angle1 < 180.0f)
-		{
-		    p[0].x = s->width / 2 - s->height / TAN (angle1);
-		    p[0].y = 0;
-		}
-		else
-		{
-		    p[0].x = s->width;
-		    p[0].y = s->height;
-		}
+    FROST_SCREEN (s);
 
-		/* software rasterizer doesn't support triangles yet so wiper
-		   effect will only work with FBOs right now */
-		frostVertices (s, GL_TRIANGLES, p, 3, 0.0f);
-	    }
+    cot0 = wiperCot (fs->wipeAngle0);
+    cot1 = wiperCot (fs->wipeAngle1);
 
-#undef TAN
+    px	  = g->width / 2.0f;
+    dyMax = g->height;
 
-	}
+    if (cot1 > 0.0f)
+	dyMax = MIN (dyMax, px / cot1 + 1.0f);
+    if (cot0 < 0.0f)
+	dyMax = MIN (dyMax, (g->width - px) / -cot0 + 1.0f);
+
+    yMin = MAX (g->height - (int) ceilf (dyMax), 0);
+
+    p = malloc (sizeof (XPoint) * 2 * (g->height - yMin));
+    if (!p)
+	return;
+
+    for (y = yMin; y < g->height; y++)
+    {
+	dy = g->height - (y + 0.5f);
+
+	x0 = MAX ((int) floorf (px - dy * cot0), 0);
+	x1 = MIN ((int) ceilf (px - dy * cot1), g->width - 1);
 
-	frostUpdate (s, 0.8f);
+	if (x0 > x1)
+	    continue;
+
+	p[n].x = x0;
+	p[n].y = y;
+	n++;
+
+	p[n].x = x1;
+	p[n].y = y;
+	n++;
     }
 
-    UNWRAP (fs, s, preparePaintScreen);
-    (*s->preparePaintScreen) (s, msSinceLastPaint);
-    WRAP (fs, s, preparePaintScreen, frostPreparePaintScreen);
-}
+    if (n && !fboSpans (s, g, p, n, 0.0f))
+    {
+	frostGridField (g, &f);
+	frostRasterSpans (&f, p, n, 0.0f);
+    }
 
-static void
-frostDonePaintScreen (CompScreen *s)
-{
-    FROST_SCREEN (s);
+    if (n && g->ice)
+	frostMeltSpans (g, p, n);
 
-    if (fs->count)
-	damageScreen (s);
+    free (p);
 
-    UNWRAP (fs, s, donePaintScreen);
-    (*s->donePaintScreen) (s);
-    WRAP (fs, s, donePaintScreen, frostDonePaintScreen);
+    if (g->count < COUNT_MAX)
+	g->count = COUNT_MAX;
 }
 
+/* advance the grid by one STEP_MS step, in as many sub-steps as the
+   stencil needs to stay stable */
 static void
-frostHandleMotionEvent (CompDisplay *d,
-			Window	    root)
+frostUpdate (CompScreen *s,
+	     frostGrid  *g)
 {
-    CompScreen *s;
+    GLfloat fade;
+    int	    i;
 
-    s = findScreenAtDisplay (d, root);
-    if (s)
+    FROST_DISPLAY (s->display);
+
+    fade = fd->stepFade;
+
+    /* fade out the last third of the activity */
+    if (g->count < COUNT_MAX / 3)
     {
-	FROST_SCREEN (s);
+	if (g->count > 1)
+	    fade *= powf (0.90f + g->count / (COUNT_MAX * 10.0f / 3.0f),
+			  1.0f / fd->subSteps);
+	else
+	    fade = 0.0f;
+    }
 
-	if (fs->grabIndex)
-	{
-	    XPoint p[2];
+    /* only the last sub-step of the software path uploads its result */
+    for (i = 0; i < fd->subSteps; i++)
+	if (!fboUpdate (s, g, fd->stepSpeed, fade))
+	    softwareUpdate (s, g, fd->stepSpeed, fade,
+			    i == fd->subSteps - 1);
+}
 
-	    p[0].x = frostLastPointerX;
-	    p[0].y = frostLastPointerY;
+/* records are collected in a buffer and written out when it is full */
+#define TRACE_BUFFER_SIZE (64 * 1024)
 
-	    p[1].x = frostLastPointerX = pointerX;
-	    p[1].y = frostLastPointerY = pointerY;
+static int
+frostElapsed (const struct timeval *start)
+{
+    struct timeval now;
 
-	    frostVertices (s, GL_LINES, p, 2, 0.2f);
+    gettimeofday (&now, NULL);
 
-	    damageScreen (s);
-	}
-    }
+    return (now.tv_sec - start->tv_sec) * 1000000 +
+	   (now.tv_usec - start->tv_usec);
 }
 
-static Bool
-frostInitiate (CompDisplay     *d,
-	       CompAction      *action,
-	       CompActionState state,
-	       CompOption      *option,
-	       int	       nOption)
-{
-    CompScreen   *s;
-    unsigned int ui;
-    Window	 root, child;
-    int	         xRoot, yRoot, i;
+static void
+frostCloseTrace (CompDisplay *d);
 
-    for (s = d->screens; s; s = s->next)
-    {
-	FROST_SCREEN (s);
+static void
+frostFlushTrace (CompDisplay *d)
+{
+    unsigned char *p;
+    ssize_t	  n;
 
-	if (otherScreenGrabExist (s, "frost", NULL))
-	    continue;
+    FROST_DISPLAY (d);
 
-	if (!fs->grabIndex)
-	    fs->grabIndex = pushScreenGrab (s, None, "frost");
+    p = fd->traceBuffer;
 
-	if (XQueryPointer (d->display, s->root, &root, &child, &xRoot, &yRoot,
-			   &i, &i, &ui))
+    while (fd->traceFill)
+    {
+	n = write (fd->traceFd, p, fd->traceFill);
+	if (n < 0)
 	{
-	    XPoint p;
-
-	    p.x = frostLastPointerX = xRoot;
-	    p.y = frostLastPointerY = yRoot;
+	    if (errno == EINTR)
+		continue;
 
-	    frostVertices (s, GL_POINTS, &p, 1, 0.8f);
+	    compLogMessage ("frost", CompLogLevelWarn,
+			    "trace write failed, recording stopped");
 
-	    damageScreen (s);
+	    fd->traceFill = 0;
+	    frostCloseTrace (d);
+	    return;
 	}
+
+	p	      += n;
+	fd->traceFill -= n;
     }
+}
 
-    if (state & CompActionStateInitButton)
-	action->state |= CompActionStateTermButton;
+static void
+frostCloseTrace (CompDisplay *d)
+{
+    FROST_DISPLAY (d);
 
-    if (state & CompActionStateInitKey)
-	action->state |= CompActionStateTermKey;
+    if (fd->traceFd < 0)
+	return;
 
-    return FALSE;
+    frostFlushTrace (d);
+
+    /* a failed flush closes the trace itself */
+    if (fd->traceFd < 0)
+	return;
+
+    close (fd->traceFd);
+    fd->traceFd = -1;
+
+    free (fd->traceBuffer);
+    fd->traceBuffer = NULL;
 }
 
-static Bool
-frostTerminate (CompDisplay	*d,
-		CompAction	*action,
-		CompActionState state,
-		CompOption	*option,
-		int		nOption)
+/* append one record and its payload, only full buffers reach the file */
+static void
+frostTrace (CompScreen	     *s,
+	    FrostTraceRecord *r,
+	    const void	     *payload,
+	    int		     size)
 {
-    CompScreen *s;
+    struct timeval now;
 
-    for (s = d->screens; s; s = s->next)
+    FROST_DISPLAY (s->display);
+
+    if (fd->traceFd < 0 || fd->traceReplay)
+	return;
+
+    gettimeofday (&now, NULL);
+
+    r->screen = s->screenNum;
+    r->time   = (now.tv_sec - fd->traceLast.tv_sec) * 1000000 +
+		(now.tv_usec - fd->traceLast.tv_usec);
+
+    fd->traceLast = now;
+
+    if (fd->traceFill + sizeof (*r) + size > TRACE_BUFFER_SIZE)
     {
-	FROST_SCREEN (s);
+	frostFlushTrace (s->display);
+	if (fd->traceFd < 0)
+	    return;
+    }
 
-	if (fs->grabIndex)
-	{
-	    removeScreenGrab (s, fs->grabIndex, 0);
-	    fs->grabIndex = 0;
-	}
+    memcpy (fd->traceBuffer + fd->traceFill, r, sizeof (*r));
+    fd->traceFill += sizeof (*r);
+
+    /* payloads larger than the buffer go straight to the file */
+    if (sizeof (*r) + size > TRACE_BUFFER_SIZE)
+    {
+	frostFlushTrace (s->display);
+	if (fd->traceFd >= 0 && write (fd->traceFd, payload, size) != size)
+	    frostCloseTrace (s->display);
+
+	return;
     }
 
-    return FALSE;
+    if (size)
+    {
+	memcpy (fd->traceBuffer + fd->traceFill, payload, size);
+	fd->traceFill += size;
+    }
 }
 
-static Bool
-frostToggleRain (CompDisplay     *d,
-		 CompAction      *action,
-		 CompActionState state,
-		 CompOption      *option,
-		 int	         nOption)
+static void
+frostOpenTrace (CompDisplay *d)
 {
-    CompScreen *s;
+    FrostTraceRecord r;
+    const char	     *path;
 
     FROST_DISPLAY (d);
 
-    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root", 0));
-    if (s)
-    {
-	FROST_SCREEN (s);
+    frostCloseTrace (d);
 
-	if (!fs->rainHandle)
-	{
-	    int delay;
+    path = fd->opt[FROST_DISPLAY_OPTION_TRACE_FILE].value.s;
+    if (!path || !*path)
+	return;
 
-	    delay = fd->opt[FROST_DISPLAY_OPTION_RAIN_DELAY].value.i;
-	    fs->rainHandle = compAddTimeout (delay, (float) delay * 1.2,
-					     frostRainTimeout, s);
-	}
-	else
-	{
-	    compRemoveTimeout (fs->rainHandle);
-	    fs->rainHandle = 0;
-	}
+    fd->traceBuffer = malloc (TRACE_BUFFER_SIZE);
+    if (!fd->traceBuffer)
+	return;
+
+    /* every session appends its own start record */
+    fd->traceFd = open (path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd->traceFd < 0)
+    {
+	compLogMessage ("frost", CompLogLevelWarn,
+			"couldn't open trace file %s", path);
+
+	free (fd->traceBuffer);
+	fd->traceBuffer = NULL;
+	return;
     }
 
-    return FALSE;
+    gettimeofday (&fd->traceLast, NULL);
+
+    memset (&r, 0, sizeof (r));
+
+    r.kind = TRACE_START;
+    r.a	   = TRACE_MAGIC;
+    r.b	   = TRACE_VERSION;
+
+    memcpy (fd->traceBuffer, &r, sizeof (r));
+    fd->traceFill = sizeof (r);
 }
 
-static Bool
-frostToggleWiper (CompDisplay     *d,
-		  CompAction      *action,
-		  CompActionState state,
-		  CompOption      *option,
-		  int	          nOption)
+/* Disturb every grid with n vertices of the given primitive type.
+   Amplitudes are v for all of them or, when amp is not NULL, given per
+   vertex. */
+static void
+frostAmplitudeVertices (CompScreen  *s,
+			GLenum	    type,
+			XPoint	    *p,
+			const float *amp,
+			int	    n,
+			float	    v)
 {
-    CompScreen *s;
+    FrostField f;
+    XPoint     *q;
+    float      *qAmp = NULL;
+    int	       i, m;
 
-    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root", 0));
-    if (s)
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    if (!s->fragmentProgram || !n)
+	return;
+
+    if (fd->traceFd >= 0)
     {
-	FROST_SCREEN (s);
+	FrostTraceRecord r;
+	unsigned char	 *payload;
+
+	memset (&r, 0, sizeof (r));
 
-	if (!fs->wiperHandle)
+	r.kind = TRACE_VERTICES;
+	r.a    = type;
+	r.b    = n;
+	r.f0   = v;
+
+	if (amp)
 	{
-	    fs->wiperHandle = compAddTimeout (2000, 2400, frostWiperTimeout, s);
+	    /* the amplitudes follow the points */
+	    payload = malloc ((sizeof (XPoint) + sizeof (float)) * n);
+	    if (payload)
+	    {
+		memcpy (payload, p, sizeof (XPoint) * n);
+		memcpy (payload + sizeof (XPoint) * n, amp, sizeof (float) * n);
+
+		r.flags = TRACE_AMPLITUDES;
+
+		frostTrace (s, &r, payload,
+			    (sizeof (XPoint) + sizeof (float)) * n);
+		free (payload);
+	    }
 	}
 	else
 	{
-	    compRemoveTimeout (fs->wiperHandle);
-	    fs->wiperHandle = 0;
+	    frostTrace (s, &r, p, sizeof (XPoint) * n);
 	}
     }
 
-    return FALSE;
-}
-
-static Bool
-frostTitleWave (CompDisplay     *d,
-		CompAction      *action,
-		CompActionState state,
-		CompOption      *option,
-		int	        nOption)
-{
-    CompWindow *w;
-    int	       xid;
+    q = malloc ((sizeof (XPoint) + (amp ? sizeof (float) : 0)) *
+		FROST_CLIP_SIZE (n));
+    if (!q)
+	return;
 
-    xid = getIntOptionNamed (option, nOption, "window", d->activeWindow);
+    if (amp)
+	qAmp = (float *) (q + FROST_CLIP_SIZE (n));
 
-    w = findWindowAtDisplay (d, xid);
-    if (w)
+    /* every grid clips into its own copy, primitives that cross outputs
+       end up on all of them */
+    for (i = 0; i < fs->nGrid; i++)
     {
-	XPoint p[2];
+	frostGrid *g = &fs->grids[i];
 
-	p[0].x = w->attrib.x - w->input.left;
-	p[0].y = w->attrib.y - w->input.top / 2;
+	if (!g->data)
+	    continue;
 
-	p[1].x = w->attrib.x + w->width + w->input.right;
-	p[1].y = p[0].y;
+	frostGridField (g, &f);
 
-	frostVertices (w->screen, GL_LINES, p, 2, 0.15f);
+	m = frostClipVertices (&f, &fd->brush, type, p, amp, n, q, qAmp);
+	if (!m)
+	    continue;
 
-	damageScreen (w->screen);
+	if (!fboVertices (s, g, type, q, qAmp, m, v))
+	    frostRasterVertices (&f, &fd->brush, type, q, qAmp, m, v);
+
+	if (g->ice)
+	    frostMeltVertices (s, g, type, q, m);
+
+	if (g->count < COUNT_MAX)
+	    g->count = COUNT_MAX;
     }
 
-    return FALSE;
+    free (q);
 }
 
-static Bool
-frostPoint (CompDisplay     *d,
-	    CompAction      *action,
-	    CompActionState state,
-	    CompOption      *option,
-	    int	            nOption)
-{
+static void
+frostVertices (CompScreen *s,
+	       GLenum     type,
+	       XPoint     *p,
+	       int	  n,
+	       float	  v)
+{
+    frostAmplitudeVertices (s, type, p, NULL, n, v);
+}
+
+/* xorshift32, kept per screen so rain neither takes the libc rand ()
+   lock nor shares its state with other plugins */
+static inline unsigned int
+frostRandom (frostScreen *fs)
+{
+    unsigned int x = fs->rainState;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return fs->rainState = x;
+}
+
+/* uniform float in [0, 1) from the top 24 bits */
+#define RANDOM_FLOAT(fs) ((frostRandom (fs) >> 8) * (1.0f / 16777216.0f))
+
+static void
+frostSeedRain (CompScreen *s,
+	       int	  seed)
+{
+    unsigned int x;
+
+    FROST_SCREEN (s);
+
+    if (seed)
+	x = (unsigned int) seed;
+    else
+	x = (unsigned int) time (NULL) ^ ((unsigned int) getpid () << 16);
+
+    /* spread the seed so that screens and small seeds diverge quickly */
+    x += (unsigned int) s->screenNum * 0x9e3779b9u;
+    x = (x ^ (x >> 16)) * 0x45d9f3bu;
+    x = (x ^ (x >> 16)) * 0x45d9f3bu;
+    x ^= x >> 16;
+
+    fs->rainState = x ? x : 0x9e3779b9u;
+}
+
+static void
+frostRainDrops (CompScreen *s,
+		XPoint	   *p,
+		float	   *amp,
+		int	   n)
+{
+    FROST_SCREEN (s);
+
+    while (n--)
+    {
+	p->x = (int) (s->width  * RANDOM_FLOAT (fs));
+	p->y = (int) (s->height * RANDOM_FLOAT (fs));
+
+	*amp++ = 0.8f * RANDOM_FLOAT (fs);
+	p++;
+    }
+}
+
+static Bool
+frostRainTimeout (void *closure)
+{
+    CompDisplay *d = closure;
+    CompScreen  *s;
+    XPoint	p;
+    float	amp;
+
+    for (s = d->screens; s; s = s->next)
+    {
+	FROST_SCREEN (s);
+
+	if (!fs->rain)
+	    continue;
+
+	frostRainDrops (s, &p, &amp, 1);
+
+	frostVertices (s, GL_POINTS, &p, 1, amp);
+
+	damageScreen (s);
+    }
+
+    return TRUE;
+}
+
+/* run the shared rain timer only while some screen has rain enabled */
+static void
+frostUpdateRainTimeout (CompDisplay *d)
+{
     CompScreen *s;
-    int	       xid;
+    Bool       rain = FALSE;
+
+    FROST_DISPLAY (d);
+
+    for (s = d->screens; s; s = s->next)
+	rain |= GET_FROST_SCREEN (s, fd)->rain;
+
+    if (rain && !fd->rainHandle)
+    {
+	int delay;
+
+	delay = fd->opt[FROST_DISPLAY_OPTION_RAIN_DELAY].value.i;
+	fd->rainHandle = compAddTimeout (delay, (float) delay * 1.2,
+					 frostRainTimeout, d);
+    }
+    else if (!rain && fd->rainHandle)
+    {
+	compRemoveTimeout (fd->rainHandle);
+	fd->rainHandle = 0;
+    }
+}
+
+static void
+frostFiniGrid (CompScreen *s,
+	       frostGrid  *g)
+{
+    int i;
+
+    for (i = 0; i < TEXTURE_NUM; i++)
+    {
+	if (g->texture[i])
+	    glDeleteTextures (1, &g->texture[i]);
+    }
+
+    if (g->data)
+	free (g->data);
+
+    frostFiniIce (g);
+
+    memset (g, 0, sizeof (frostGrid));
+}
+
+static void
+frostFiniGrids (CompScreen *s)
+{
+    int i;
+
+    FROST_SCREEN (s);
+
+    for (i = 0; i < fs->nGrid; i++)
+	frostFiniGrid (s, &fs->grids[i]);
+
+    if (fs->grids)
+	free (fs->grids);
+
+    fs->grids = NULL;
+    fs->nGrid = 0;
+}
+
+/* Make sure g->data holds two heightfields of the grid size. Rows are
+   padded to whole cache lines and the pitch avoids multiples of 4k so
+   the rows of the stencil don't share cache sets, the second field is
+   staggered for the same reason. Blocks are reused when large enough,
+   large grids can ask for transparent huge pages. */
+static Bool
+allocHeights (CompScreen *s,
+	      frostGrid  *g)
+{
+    int size, total;
+
+    FROST_DISPLAY (s->display);
+
+    g->pitch = (g->width + 2 + ROW_ALIGN - 1) & ~(ROW_ALIGN - 1);
+    if ((g->pitch * sizeof (float)) % 4096 == 0)
+	g->pitch += ROW_ALIGN;
+
+    size  = g->pitch * (g->height + 2);
+    total = ROW_ALIGN + size * 2 + FIELD_STAGGER;
+
+    if (!g->data || g->capacity < total)
+    {
+	size_t bytes = sizeof (float) * total;
+	Bool   huge;
+
+	if (g->data)
+	    free (g->data);
+
+	huge = fd->opt[FROST_DISPLAY_OPTION_HUGE_PAGES].value.b &&
+	       bytes >= HUGE_PAGE_SIZE;
+
+	if (posix_memalign (&g->data,
+			    huge ? HUGE_PAGE_SIZE : ROW_ALIGN * sizeof (float),
+			    bytes))
+	{
+	    g->data	= NULL;
+	    g->capacity = 0;
+	    return FALSE;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if (huge)
+	    madvise (g->data, bytes, MADV_HUGEPAGE);
+#endif
+
+	g->capacity = total;
+    }
+
+    memset (g->data, 0, sizeof (float) * total);
+
+    /* the left border sits just before the line that starts each row */
+    g->d0 = (float *) g->data + ROW_ALIGN - 1;
+    g->d1 = g->d0 + size + FIELD_STAGGER;
+
+    return TRUE;
+}
+
+/* bilinear resample of a bordered heightfield */
+static void
+resampleHeights (float	     *dst,
+		 int	     dWidth,
+		 int	     dHeight,
+		 int	     dPitch,
+		 const float *src,
+		 int	     sWidth,
+		 int	     sHeight,
+		 int	     sPitch)
+{
+    const float *r0, *r1;
+    float	fx, fy, sx, sy, wx, wy;
+    int		x, y, x0, x1, y0, y1;
+
+    fx = (float) sWidth  / dWidth;
+    fy = (float) sHeight / dHeight;
+
+    for (y = 0; y < dHeight; y++)
+    {
+	sy = MAX ((y + 0.5f) * fy - 0.5f, 0.0f);
+	y0 = MIN ((int) sy, sHeight - 1);
+	y1 = MIN (y0 + 1, sHeight - 1);
+	wy = sy - y0;
+
+	r0 = src + sPitch * (y0 + 1) + 1;
+	r1 = src + sPitch * (y1 + 1) + 1;
+
+	for (x = 0; x < dWidth; x++)
+	{
+	    sx = MAX ((x + 0.5f) * fx - 0.5f, 0.0f);
+	    x0 = MIN ((int) sx, sWidth - 1);
+	    x1 = MIN (x0 + 1, sWidth - 1);
+	    wx = sx - x0;
+
+	    dst[dPitch * (y + 1) + x + 1] =
+		(r0[x0] * (1.0f - wx) + r0[x1] * wx) * (1.0f - wy) +
+		(r1[x0] * (1.0f - wx) + r1[x1] * wx) * wy;
+	}
+
+	dst[dPitch * (y + 1)]		   = dst[dPitch * (y + 1) + 1];
+	dst[dPitch * (y + 1) + dWidth + 1] = dst[dPitch * (y + 1) + dWidth];
+    }
+
+    memcpy (dst, dst + dPitch, (dWidth + 2) * sizeof (float));
+    memcpy (dst + dPitch * (dHeight + 1), dst + dPitch * dHeight,
+	    (dWidth + 2) * sizeof (float));
+}
+
+/* render the old textures scaled into textures of the new grid size */
+static void
+fboResample (CompScreen *s,
+	     frostGrid  *old,
+	     frostGrid  *g,
+	     GLenum	oldTarget)
+{
+    int i;
+
+    for (i = 0; i < TEXTURE_NUM; i++)
+    {
+	if (!old->texture[i])
+	    continue;
+
+	if (!fboPrologue (s, g, i))
+	    return;
+
+	glEnable (oldTarget);
+	glBindTexture (oldTarget, old->texture[i]);
+
+	glBegin (GL_QUADS);
+
+	glTexCoord2f (0.0f, 0.0f);
+	glVertex2f   (0.0f, 0.0f);
+	glTexCoord2f (old->tx, 0.0f);
+	glVertex2f   (1.0f, 0.0f);
+	glTexCoord2f (old->tx, old->ty);
+	glVertex2f   (1.0f, 1.0f);
+	glTexCoord2f (0.0f, old->ty);
+	glVertex2f   (0.0f, 1.0f);
+
+	glEnd ();
+
+	glBindTexture (oldTarget, 0);
+	glDisable (oldTarget);
+
+	fboEpilogue (s);
+    }
+}
+
+/* carry the live state of old over into g, which already has its new
+   geometry, and release what old no longer needs */
+static void
+frostResizeGrid (CompScreen *s,
+		 frostGrid  *old,
+		 frostGrid  *g,
+		 GLenum	    oldTarget)
+{
+    float *tmp;
+    int	  oldSize;
+
+    FROST_SCREEN (s);
+
+    g->count  = old->count;
+    g->tIndex = old->tIndex;
+
+    if (old->width == g->width && old->height == g->height &&
+	oldTarget == fs->target)
+    {
+	memcpy (g->texture, old->texture, sizeof (g->texture));
+
+	/* the textures keep the format they were uploaded in */
+	g->heightOnly = old->heightOnly;
+
+	g->data	    = old->data;
+	g->capacity = old->capacity;
+	g->pitch    = old->pitch;
+	g->d0	    = old->d0;
+	g->d1	    = old->d1;
+
+	/* ice only survives when the grid keeps its size */
+	g->ice	       = old->ice;
+	g->iceTiles    = old->iceTiles;
+	g->iceTilesX   = old->iceTilesX;
+	g->iceTilesY   = old->iceTilesY;
+	g->iceActive   = old->iceActive;
+	g->iceStep     = old->iceStep;
+	g->iceY0       = old->iceY0;
+	g->iceY1       = old->iceY1;
+	g->iceTexture  = old->iceTexture;
+
+	g->iceDamageY0 = 0;
+	g->iceDamageY1 = g->height;
+
+	memset (old, 0, sizeof (frostGrid));
+	return;
+    }
+
+    /* the old fields may share their block with the new ones */
+    oldSize = old->pitch * (old->height + 2);
+    tmp = NULL;
+
+    if (old->data)
+    {
+	tmp = malloc (sizeof (float) * oldSize * 2);
+	if (tmp)
+	{
+	    memcpy (tmp, old->d0, sizeof (float) * oldSize);
+	    memcpy (tmp + oldSize, old->d1, sizeof (float) * oldSize);
+	}
+    }
+
+    g->data	= old->data;
+    g->capacity = old->capacity;
+    old->data	= NULL;
+
+    if (allocHeights (s, g) && tmp)
+    {
+	resampleHeights (g->d0, g->width, g->height, g->pitch,
+			 tmp, old->width, old->height, old->pitch);
+	resampleHeights (g->d1, g->width, g->height, g->pitch,
+			 tmp + oldSize, old->width, old->height, old->pitch);
+    }
+
+    if (tmp)
+	free (tmp);
+
+    if (fs->fbo)
+	fboResample (s, old, g, oldTarget);
+
+    frostFiniGrid (s, old);
+}
+
+/* unclaimed old grid that covers exactly the output of g, or with
+   overlap set the one that covers the most of it, -1 if there is none */
+static int
+frostMatchGrid (CompScreen *s,
+		frostGrid  *g,
+		Bool	   *claimed,
+		Bool	   overlap)
+{
+    int i, w, h, area, best = -1, bestArea = 0;
+
+    FROST_SCREEN (s);
+
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *old = &fs->grids[i];
+
+	if (claimed[i])
+	    continue;
+
+	if (old->x == g->x && old->y == g->y &&
+	    old->outputWidth == g->outputWidth &&
+	    old->outputHeight == g->outputHeight)
+	    return i;
+
+	if (!overlap)
+	    continue;
+
+	w = MIN (old->x + old->outputWidth, g->x + g->outputWidth) -
+	    MAX (old->x, g->x);
+	h = MIN (old->y + old->outputHeight, g->y + g->outputHeight) -
+	    MAX (old->y, g->y);
+
+	if (w <= 0 || h <= 0)
+	    continue;
+
+	area = w * h;
+	if (area > bestArea)
+	{
+	    best     = i;
+	    bestArea = area;
+	}
+    }
+
+    return best;
+}
+
+/* One grid per output. All grids share the cell size of the tallest
+   output, so ripples keep their proportions across monitors and no
+   cells are spent on the gaps between outputs. Grids that survive a
+   reconfiguration are resampled rather than restarted, each new output
+   takes over the old grid with the same geometry first and the one it
+   overlaps most otherwise. Outputs that overlap none start flat. */
+static void
+frostReset (CompScreen *s)
+{
+    frostGrid *grids;
+    GLenum    oldTarget;
+    int	      i, nGrid, maxHeight = 1, resolution, *match;
+    Bool      pot = TRUE, *claimed;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    resolution = fd->opt[FROST_DISPLAY_OPTION_RESOLUTION].value.i;
+
+    nGrid = s->nOutputDev;
+
+    grids = calloc (nGrid, sizeof (frostGrid));
+    if (!grids)
+	return;
+
+    for (i = 0; i < nGrid; i++)
+	maxHeight = MAX (maxHeight, s->outputDev[i].height);
+
+    for (i = 0; i < nGrid; i++)
+    {
+	frostGrid *g = &grids[i];
+	BOX	  *box = &s->outputDev[i].region.extents;
+
+	g->x		= box->x1;
+	g->y		= box->y1;
+	g->outputWidth  = MAX (box->x2 - box->x1, 1);
+	g->outputHeight = MAX (box->y2 - box->y1, 1);
+
+	g->height = MAX ((resolution * g->outputHeight) / maxHeight, 1);
+	g->width  = MAX ((resolution * g->outputWidth)  / maxHeight, 1);
+
+	if (!POWER_OF_TWO (g->width) || !POWER_OF_TWO (g->height))
+	    pot = FALSE;
+    }
+
+    oldTarget = fs->target;
+
+    if (s->textureNonPowerOfTwo || pot)
+	fs->target = GL_TEXTURE_2D;
+    else
+	fs->target = GL_TEXTURE_RECTANGLE_NV;
+
+    for (i = 0; i < nGrid; i++)
+    {
+	frostGrid *g = &grids[i];
+
+	if (fs->target == GL_TEXTURE_2D)
+	{
+	    g->tx = g->ty = 1.0f;
+	}
+	else
+	{
+	    g->tx = g->width;
+	    g->ty = g->height;
+	}
+    }
+
+    if (!s->fragmentProgram)
+    {
+	frostFiniGrids (s);
+
+	fs->grids = grids;
+	fs->nGrid = nGrid;
+
+	return;
+    }
+
+    if (s->fbo && !fs->fbo)
+    {
+	(*s->genFramebuffers) (1, &fs->fbo);
+	fs->fboStatus = 0;
+    }
+
+    match   = malloc (sizeof (int) * nGrid);
+    claimed = calloc (fs->nGrid + 1, sizeof (Bool));
+    if (!match || !claimed)
+    {
+	if (match)
+	    free (match);
+	if (claimed)
+	    free (claimed);
+
+	free (grids);
+	return;
+    }
+
+    /* exact matches first, so a moved output can't take the grid of one
+       that stayed in place */
+    for (i = 0; i < nGrid; i++)
+    {
+	match[i] = frostMatchGrid (s, &grids[i], claimed, FALSE);
+	if (match[i] >= 0)
+	    claimed[match[i]] = TRUE;
+    }
+
+    for (i = 0; i < nGrid; i++)
+    {
+	if (match[i] >= 0)
+	    continue;
+
+	match[i] = frostMatchGrid (s, &grids[i], claimed, TRUE);
+	if (match[i] >= 0)
+	    claimed[match[i]] = TRUE;
+    }
+
+    for (i = 0; i < nGrid; i++)
+    {
+	frostGrid *g = &grids[i];
+
+	if (match[i] >= 0)
+	    frostResizeGrid (s, &fs->grids[match[i]], g, oldTarget);
+	else
+	    allocHeights (s, g);
+    }
+
+    free (claimed);
+    free (match);
+
+    if (s->fbo)
+	loadfrostProgram (s);
+
+    frostFiniGrids (s);
+
+    fs->grids = grids;
+    fs->nGrid = nGrid;
+
+    fs->generation++;
+
+    /* build the table now rather than on the first simulation step */
+    if (fd->opt[FROST_DISPLAY_OPTION_NORMAL_MODE].value.i == NORMAL_MODE_TABLE)
+	frostGetNormalTable (s->display);
+}
+
+static void
+frostOutputChangeNotify (CompScreen *s)
+{
+    FROST_SCREEN (s);
+
+    frostReset (s);
+
+    UNWRAP (fs, s, outputChangeNotify);
+    (*s->outputChangeNotify) (s);
+    WRAP (fs, s, outputChangeNotify, frostOutputChangeNotify);
+}
+
+/* grid of the output a window is mostly on */
+static frostGrid *
+frostWindowGrid (CompWindow *w)
+{
+    int output;
+
+    FROST_SCREEN (w->screen);
+
+    output = outputDeviceForWindow (w);
+    if (output < 0 || output >= fs->nGrid)
+	return NULL;
+
+    return &fs->grids[output];
+}
+
+/* map the output the grid covers onto the whole texture bound to the
+   active unit */
+static void
+frostTexGen (frostGrid *g)
+{
+    GLfloat plane[4];
+
+    plane[1] = plane[2] = 0.0f;
+    plane[0] = g->tx / (GLfloat) g->outputWidth;
+    plane[3] = -g->x * plane[0];
+
+    glTexGeni (GL_S, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+    glTexGenfv (GL_S, GL_EYE_PLANE, plane);
+    glEnable (GL_TEXTURE_GEN_S);
+
+    plane[0] = plane[2] = 0.0f;
+    plane[1] = g->ty / (GLfloat) g->outputHeight;
+    plane[3] = -g->y * plane[1];
+
+    glTexGeni (GL_T, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+    glTexGenfv (GL_T, GL_EYE_PLANE, plane);
+    glEnable (GL_TEXTURE_GEN_T);
+}
+
+static void
+frostReleaseUnit (CompScreen	 *s,
+		  frostUnitState *state)
+{
+    FROST_SCREEN (s);
+
+    if (state->unit < 0)
+	return;
+
+    (*s->activeTexture) (GL_TEXTURE0_ARB + state->unit);
+    glDisable (GL_TEXTURE_GEN_T);
+    glDisable (GL_TEXTURE_GEN_S);
+    glBindTexture (fs->target, 0);
+    (*s->activeTexture) (GL_TEXTURE0_ARB);
+
+    state->unit	   = -1;
+    state->texture = 0;
+    state->planes  = NULL;
+}
+
+/* tear down whatever the window draws left set up */
+static void
+frostFlushState (CompScreen *s)
+{
+    FROST_SCREEN (s);
+
+    frostReleaseUnit (s, &fs->bumpState);
+    frostReleaseUnit (s, &fs->iceState);
+
+    fs->envValid = 0;
+}
+
+/* Bind texture with texgen for grid g on unit, touching only what
+   differs from the last draw. The texture is filtered linearly whatever
+   the window paint path does with the window texture. Eye planes depend
+   on the modelview, so they are loaded again for transformed windows. */
+static void
+frostBindUnit (CompScreen     *s,
+	       frostUnitState *state,
+	       frostUnitState *other,
+	       int	      unit,
+	       GLuint	      texture,
+	       frostGrid      *g,
+	       Bool	      transformed)
+{
+    FROST_SCREEN (s);
+
+    /* the unit is taken over from the other state */
+    if (other->unit == unit)
+    {
+	other->unit    = -1;
+	other->texture = 0;
+	other->planes  = NULL;
+    }
+
+    if (state->unit != unit)
+	frostReleaseUnit (s, state);
+
+    if (state->unit == unit && state->texture == texture &&
+	state->planes == g && !transformed)
+	return;
+
+    (*s->activeTexture) (GL_TEXTURE0_ARB + unit);
+
+    if (state->unit != unit || state->texture != texture)
+    {
+	glBindTexture (fs->target, texture);
+	glTexParameteri (fs->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (fs->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    if (state->unit != unit || state->planes != g || transformed)
+	frostTexGen (g);
+
+    (*s->activeTexture) (GL_TEXTURE0_ARB);
+
+    state->unit	   = unit;
+    state->texture = texture;
+    state->planes  = transformed ? NULL : g;
+}
+
+static void
+frostSetEnv (CompScreen *s,
+	     int	index,
+	     GLfloat	x,
+	     GLfloat	y,
+	     GLfloat	z,
+	     GLfloat	w)
+{
+    GLfloat *v;
+
+    FROST_SCREEN (s);
+
+    if (index >= ENV_CACHE_SIZE)
+    {
+	(*s->programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB, index,
+				     x, y, z, w);
+	return;
+    }
+
+    v = fs->env[index];
+
+    if ((fs->envValid & (1 << index)) &&
+	v[0] == x && v[1] == y && v[2] == z && v[3] == w)
+	return;
+
+    (*s->programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB, index, x, y, z, w);
+
+    v[0] = x;
+    v[1] = y;
+    v[2] = z;
+    v[3] = w;
+
+    fs->envValid |= 1 << index;
+}
+
+/* make sure the post pass program and scene texture match the current
+   targets and screen size */
+static Bool
+frostPostPrologue (CompScreen *s)
+{
+    char buffer[1024];
+
+    FROST_SCREEN (s);
+
+    fs->sceneTarget = s->textureNonPowerOfTwo ? GL_TEXTURE_2D :
+					       GL_TEXTURE_RECTANGLE_NV;
+
+    if (!fs->postProgram || fs->postTarget != fs->target)
+    {
+	snprintf (buffer, sizeof (buffer), frostPostFpString,
+		  (fs->target == GL_TEXTURE_2D) ? "2D" : "RECT",
+		  (fs->sceneTarget == GL_TEXTURE_2D) ? "2D" : "RECT");
+
+	if (!loadFragmentProgram (s, &fs->postProgram, buffer))
+	    return FALSE;
+
+	fs->postTarget = fs->target;
+    }
+
+    if (!fs->sceneTexture ||
+	fs->sceneWidth != s->width || fs->sceneHeight != s->height)
+    {
+	if (!fs->sceneTexture)
+	    glGenTextures (1, &fs->sceneTexture);
+
+	glBindTexture (fs->sceneTarget, fs->sceneTexture);
+
+	glTexParameteri (fs->sceneTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (fs->sceneTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (fs->sceneTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (fs->sceneTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glTexImage2D (fs->sceneTarget, 0, GL_RGBA, s->width, s->height, 0,
+		      GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	glBindTexture (fs->sceneTarget, 0);
+
+	fs->sceneWidth  = s->width;
+	fs->sceneHeight = s->height;
+    }
+
+    return TRUE;
+}
+
+/* refract the damaged part of every rippling grid in the output once,
+   by copying the painted scene and drawing it back distorted */
+static void
+frostPostPass (CompScreen *s,
+	       Region	  region,
+	       CompOutput *output)
+{
+    CompTransform sTransform;
+    BOX		  box, copy;
+    float	  sx, sy;
+    int		  i, j, margin;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    if (!frostPostPrologue (s))
+	return;
+
+    if (fs->sceneTarget == GL_TEXTURE_2D)
+    {
+	sx = 1.0f / s->width;
+	sy = 1.0f / s->height;
+    }
+    else
+    {
+	sx = sy = 1.0f;
+    }
+
+    /* samples can land this far outside the box they are drawn to */
+    margin = (int) ceilf (fd->offsetScale) + 1;
+
+    /* the scene is copied once before anything is drawn, so that no
+       quad samples pixels another one already refracted */
+    copy.x1 = MAX (MAX (region->extents.x1, output->region.extents.x1) -
+		   margin, 0);
+    copy.y1 = MAX (MAX (region->extents.y1, output->region.extents.y1) -
+		   margin, 0);
+    copy.x2 = MIN (MIN (region->extents.x2, output->region.extents.x2) +
+		   margin, s->width);
+    copy.y2 = MIN (MIN (region->extents.y2, output->region.extents.y2) +
+		   margin, s->height);
+
+    if (copy.x1 >= copy.x2 || copy.y1 >= copy.y2)
+	return;
+
+    glBindTexture (fs->sceneTarget, fs->sceneTexture);
+    glCopyTexSubImage2D (fs->sceneTarget, 0,
+			 copy.x1, s->height - copy.y2,
+			 copy.x1, s->height - copy.y2,
+			 copy.x2 - copy.x1, copy.y2 - copy.y1);
+
+    matrixGetIdentity (&sTransform);
+    transformToScreenSpace (s, output, -DEFAULT_Z_CAMERA, &sTransform);
+
+    glPushMatrix ();
+    glLoadMatrixf (sTransform.m);
+
+    glEnable (GL_FRAGMENT_PROGRAM_ARB);
+    (*s->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, fs->postProgram);
+
+    /* the scene copy is bottom up */
+    (*s->programLocalParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 0,
+				   fd->offsetScale * sx,
+				   -fd->offsetScale * sy,
+				   0.0f, 0.0f);
+
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *g = &fs->grids[i];
+
+	if (!g->count || !g->texture[TINDEX (g, 0)])
+	    continue;
+
+	(*s->activeTexture) (GL_TEXTURE1_ARB);
+	glBindTexture (fs->target, g->texture[TINDEX (g, 0)]);
+	glTexParameteri (fs->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (fs->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	frostTexGen (g);
+	(*s->activeTexture) (GL_TEXTURE0_ARB);
+
+	for (j = 0; j < region->numRects; j++)
+	{
+	    box.x1 = MAX (region->rects[j].x1,
+			  MAX (g->x, output->region.extents.x1));
+	    box.y1 = MAX (region->rects[j].y1,
+			  MAX (g->y, output->region.extents.y1));
+	    box.x2 = MIN (region->rects[j].x2,
+			  MIN (g->x + g->outputWidth,
+			       output->region.extents.x2));
+	    box.y2 = MIN (region->rects[j].y2,
+			  MIN (g->y + g->outputHeight,
+			       output->region.extents.y2));
+
+	    if (box.x1 >= box.x2 || box.y1 >= box.y2)
+		continue;
+
+	    glBegin (GL_QUADS);
+
+	    glTexCoord2f (box.x1 * sx, (s->height - box.y1) * sy);
+	    glVertex2i (box.x1, box.y1);
+	    glTexCoord2f (box.x1 * sx, (s->height - box.y2) * sy);
+	    glVertex2i (box.x1, box.y2);
+	    glTexCoord2f (box.x2 * sx, (s->height - box.y2) * sy);
+	    glVertex2i (box.x2, box.y2);
+	    glTexCoord2f (box.x2 * sx, (s->height - box.y1) * sy);
+	    glVertex2i (box.x2, box.y1);
+
+	    glEnd ();
+	}
+
+	(*s->activeTexture) (GL_TEXTURE1_ARB);
+	glDisable (GL_TEXTURE_GEN_T);
+	glDisable (GL_TEXTURE_GEN_S);
+	glBindTexture (fs->target, 0);
+	(*s->activeTexture) (GL_TEXTURE0_ARB);
+    }
+
+    glBindTexture (fs->sceneTarget, 0);
+    glDisable (GL_FRAGMENT_PROGRAM_ARB);
+
+    glPopMatrix ();
+}
+
+static Bool
+frostPaintOutput (CompScreen		  *s,
+		  const ScreenPaintAttrib *sAttrib,
+		  const CompTransform	  *transform,
+		  Region		  region,
+		  CompOutput		  *output,
+		  unsigned int		  mask)
+{
+    Bool status;
+    int	 i;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    /* transformed screens keep refracting per window, as do height only
+       textures which carry no normals */
+    fs->postPass = FALSE;
+
+    if (fd->opt[FROST_DISPLAY_OPTION_POST_PASS].value.b &&
+	s->fragmentProgram && !(mask & PAINT_SCREEN_TRANSFORMED_MASK))
+    {
+	for (i = 0; i < fs->nGrid; i++)
+	{
+	    if (fs->grids[i].heightOnly)
+	    {
+		fs->postPass = FALSE;
+		break;
+	    }
+
+	    if (fs->grids[i].count)
+		fs->postPass = TRUE;
+	}
+    }
+
+    frostFlushState (s);
+
+    UNWRAP (fs, s, paintOutput);
+    status = (*s->paintOutput) (s, sAttrib, transform, region, output, mask);
+    WRAP (fs, s, paintOutput, frostPaintOutput);
+
+    frostFlushState (s);
+
+    if (fs->postPass)
+    {
+	frostPostPass (s, region, output);
+	fs->postPass = FALSE;
+    }
+
+    return status;
+}
+
+static void
+frostDrawWindowTexture (CompWindow	     *w,
+			CompTexture	     *texture,
+			const FragmentAttrib *attrib,
+			unsigned int	     mask)
+{
+    frostGrid *g;
+
+    FROST_SCREEN (w->screen);
+
+    g = frostWindowGrid (w);
+
+    /* the post pass refracts the whole output at once */
+    if (g && ((g->count && !fs->postPass) || g->iceTexture))
+    {
+	FragmentAttrib fa = *attrib;
+	Bool	       lighting = w->screen->lighting;
+	Bool	       transformed = mask & PAINT_WINDOW_TRANSFORMED_MASK;
+	int	       param, function = 0, unit = 0;
+	int	       iceParam, iceFunction = 0, iceUnit = 0;
+
+	FROST_DISPLAY (w->screen->display);
+
+	/* other fragment functions on the window may load env parameters
+	   of their own */
+	if (attrib->nParam)
+	    fs->envValid = 0;
+
+	if (g->count && !fs->postPass)
+	{
+	    param = allocFragmentParameters (&fa, g->heightOnly ? 2 : 1);
+	    unit  = allocFragmentTextureUnits (&fa, 1);
+
+	    function = getBumpMapFragmentFunction (w->screen, texture, unit,
+						   param, g->heightOnly);
+	}
+
+	if (function)
+	{
+	    addFragmentFunction (&fa, function);
+
+	    screenLighting (w->screen, TRUE);
+
+	    frostBindUnit (w->screen, &fs->bumpState, &fs->iceState, unit,
+			   g->texture[TINDEX (g, 0)], g, transformed);
+
+	    frostSetEnv (w->screen, param,
+			 texture->matrix.yy * fd->offsetScale,
+			 -texture->matrix.xx * fd->offsetScale,
+			 0.0f, 0.0f);
+
+	    /* heights are stored at half scale around 0.5 */
+	    if (g->heightOnly)
+		frostSetEnv (w->screen, param + 1,
+			     g->tx / g->width, g->ty / g->height,
+			     0.0f, 2.0f * fd->normalScale);
+	}
+	else
+	{
+	    frostReleaseUnit (w->screen, &fs->bumpState);
+	}
+
+	if (g->iceTexture)
+	{
+	    iceParam = allocFragmentParameters (&fa, 1);
+	    iceUnit  = allocFragmentTextureUnits (&fa, 1);
+
+	    iceFunction = getIceFragmentFunction (w->screen, texture,
+						  iceUnit, iceParam);
+	}
+
+	if (iceFunction)
+	{
+	    addFragmentFunction (&fa, iceFunction);
+
+	    frostBindUnit (w->screen, &fs->iceState, &fs->bumpState, iceUnit,
+			   g->iceTexture, g, transformed);
+
+	    frostSetEnv (w->screen, iceParam,
+			 0.85f * ICE_OPACITY,
+			 0.90f * ICE_OPACITY,
+			 0.95f * ICE_OPACITY,
+			 ICE_OPACITY);
+	}
+	else
+	{
+	    frostReleaseUnit (w->screen, &fs->iceState);
+	}
+
+	UNWRAP (fs, w->screen, drawWindowTexture);
+	(*w->screen->drawWindowTexture) (w, texture, &fa, mask);
+	WRAP (fs, w->screen, drawWindowTexture, frostDrawWindowTexture);
+
+	/* unit state stays set up for the next window */
+	if (function)
+	    screenLighting (w->screen, lighting);
+
+	/* functions added after ours load their parameters from the
+	   first index we did not allocate */
+	if (fa.nParam < ENV_CACHE_SIZE)
+	    fs->envValid &= (1 << fa.nParam) - 1;
+    }
+    else
+    {
+	/* a draw without our functions may use the units for itself */
+	frostFlushState (w->screen);
+
+	UNWRAP (fs, w->screen, drawWindowTexture);
+	(*w->screen->drawWindowTexture) (w, texture, attrib, mask);
+	WRAP (fs, w->screen, drawWindowTexture, frostDrawWindowTexture);
+    }
+}
+
+static void
+frostCloseShm (CompScreen *s)
+{
+    FROST_SCREEN (s);
+
+    if (!fs->shm)
+	return;
+
+    munmap (fs->shm, sizeof (FrostShm));
+    shm_unlink (fs->shmName);
+
+    free (fs->shmName);
+    free (fs->shmHeights);
+
+    if (fs->shmTexture)
+	glDeleteTextures (1, &fs->shmTexture);
+
+    fs->shm	   = NULL;
+    fs->shmName	   = NULL;
+    fs->shmHeights = NULL;
+    fs->shmTexture = 0;
+}
+
+static void
+frostOpenShm (CompScreen *s)
+{
+    const char *name;
+    void       *map;
+    int	       file, size;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    frostCloseShm (s);
+
+    name = fd->opt[FROST_DISPLAY_OPTION_SHM_NAME].value.s;
+    if (!name || !*name)
+	return;
+
+    size = strlen (name) + 16;
+
+    fs->shmName	   = malloc (size);
+    fs->shmHeights = malloc (sizeof (FrostShmHeights));
+    if (!fs->shmName || !fs->shmHeights)
+    {
+	free (fs->shmName);
+	free (fs->shmHeights);
+
+	fs->shmName    = NULL;
+	fs->shmHeights = NULL;
+	return;
+    }
+
+    snprintf (fs->shmName, size, "%s%s-%d", *name == '/' ? "" : "/", name,
+	      s->screenNum);
+
+    /* a segment left behind by a previous instance is taken over */
+    map  = MAP_FAILED;
+    file = shm_open (fs->shmName, O_RDWR | O_CREAT, 0600);
+    if (file >= 0)
+    {
+	if (ftruncate (file, sizeof (FrostShm)) == 0)
+	    map = mmap (NULL, sizeof (FrostShm), PROT_READ | PROT_WRITE,
+			MAP_SHARED, file, 0);
+
+	close (file);
+    }
+
+    if (map == MAP_FAILED)
+    {
+	compLogMessage ("frost", CompLogLevelWarn,
+			"couldn't create shared memory input %s",
+			fs->shmName);
+
+	if (file >= 0)
+	    shm_unlink (fs->shmName);
+
+	free (fs->shmName);
+	free (fs->shmHeights);
+
+	fs->shmName    = NULL;
+	fs->shmHeights = NULL;
+	return;
+    }
+
+    fs->shm = map;
+
+    fs->shm->magic = 0;
+    __sync_synchronize ();
+
+    memset (fs->shm, 0, sizeof (FrostShm));
+
+    fs->shm->version = FROST_SHM_VERSION;
+    fs->shm->width   = s->width;
+    fs->shm->height  = s->height;
+
+    fs->shmTail	     = 0;
+    fs->shmHeightSeq = 0;
+
+    __sync_synchronize ();
+    fs->shm->magic = FROST_SHM_MAGIC;
+}
+
+/* add the delta plane in the shm texture to the height texture of g,
+   blended with the given equation. The plane covers the whole screen
+   and the quad the part of it the grid is on */
+static int
+fboShmHeights (CompScreen *s,
+	       frostGrid  *g,
+	       GLenum	  equation)
+{
+    float sw, th, s0, t0, s1, t1;
+
+    FROST_SCREEN (s);
+
+    if (!fboPrologue (s, g, TINDEX (g, 0)))
+	return 0;
+
+    sw = th = 1.0f;
+    if (fs->target != GL_TEXTURE_2D)
+    {
+	sw = fs->shmHeights->width;
+	th = fs->shmHeights->height;
+    }
+
+    s0 = sw * g->x / s->width;
+    s1 = sw * (g->x + g->outputWidth) / s->width;
+    t0 = th * g->y / s->height;
+    t1 = th * (g->y + g->outputHeight) / s->height;
+
+    glEnable (fs->target);
+    glBindTexture (fs->target, fs->shmTexture);
+
+    glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_TRUE);
+    glEnable (GL_BLEND);
+    glBlendFunc (GL_ONE, GL_ONE);
+
+    if (equation != GL_FUNC_ADD_EXT)
+	(*fs->blendEquation) (equation);
+
+    glBegin (GL_QUADS);
+
+    glTexCoord2f (s0, t0);
+    glVertex2f   (0.0f, 0.0f);
+    glTexCoord2f (s1, t0);
+    glVertex2f   (1.0f, 0.0f);
+    glTexCoord2f (s1, t1);
+    glVertex2f   (1.0f, 1.0f);
+    glTexCoord2f (s0, t1);
+    glVertex2f   (0.0f, 1.0f);
+
+    glEnd ();
+
+    if (equation != GL_FUNC_ADD_EXT)
+	(*fs->blendEquation) (GL_FUNC_ADD_EXT);
+
+    glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable (GL_BLEND);
+    glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    glBindTexture (fs->target, 0);
+    glDisable (fs->target);
+
+    fboEpilogue (s);
+
+    return 1;
+}
+
+/* The height textures hold 8 bit heights in alpha, so the delta goes
+   through an alpha texture in two passes, the positive part added and
+   the negative part subtracted. Returns 0 when the heights are not kept
+   in textures. */
+static int
+frostShmHeightsTexture (CompScreen *s)
+{
+    static const GLenum equation[2] = {
+	GL_FUNC_ADD_EXT, GL_FUNC_REVERSE_SUBTRACT_EXT
+    };
+    FrostShmHeights *h;
+    unsigned char   *t;
+    float	    v;
+    int		    pass, size, i, any;
+
+    FROST_SCREEN (s);
+
+    if (!fs->fbo)
+	return 0;
+
+    h	 = fs->shmHeights;
+    size = h->width * h->height;
+
+    for (pass = 0; pass < 2; pass++)
+    {
+	t = frostGetScratch (s->display, size);
+	if (!t)
+	    return 1;
+
+	any = 0;
+	for (i = 0; i < size; i++)
+	{
+	    v = (pass ? -h->d[i] : h->d[i]) * 255.0f + 0.5f;
+
+	    t[i] = v <= 0.0f ? 0 : v >= 255.0f ? 255 : (unsigned char) v;
+	    any |= t[i];
+	}
+
+	if (!any)
+	    continue;
+
+	if (pass && !fs->blendEquation)
+	{
+	    if (!fs->shmSubtractWarned)
+		compLogMessage ("frost", CompLogLevelWarn,
+				"GL_EXT_blend_subtract missing, negative "
+				"height deltas are dropped");
+
+	    fs->shmSubtractWarned = TRUE;
+	    break;
+	}
+
+	if (!fs->shmTexture)
+	    glGenTextures (1, &fs->shmTexture);
+
+	glBindTexture (fs->target, fs->shmTexture);
+
+	/* nearest, like the cell centre sampling of the software path */
+	glTexParameteri (fs->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri (fs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri (fs->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (fs->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D (fs->target, 0, GL_ALPHA8, h->width, h->height, 0,
+		      GL_ALPHA, GL_UNSIGNED_BYTE, t);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+
+	glBindTexture (fs->target, 0);
+
+	for (i = 0; i < fs->nGrid; i++)
+	{
+	    frostGrid *g = &fs->grids[i];
+
+	    if (!g->data)
+		continue;
+
+	    /* the framebuffer turned out incomplete on the first pass */
+	    if (!fboShmHeights (s, g, equation[pass]))
+		return 0;
+	}
+    }
+
+    return 1;
+}
+
+/* add the latest height delta, stretched over the screen, to every grid */
+static void
+frostShmHeights (CompScreen *s)
+{
+    FrostShmHeights *h;
+    int		    width, height, i, x, y, sx, sy;
+    Bool	    texture;
+
+    FROST_SCREEN (s);
+
+    h	   = fs->shmHeights;
+    width  = h->width;
+    height = h->height;
+
+    if (!width || !height)
+	return;
+
+    texture = frostShmHeightsTexture (s);
+
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *g = &fs->grids[i];
+
+	if (!g->data)
+	    continue;
+
+	if (g->count < COUNT_MAX)
+	    g->count = COUNT_MAX;
+
+	if (texture)
+	    continue;
+
+	for (y = 0; y < g->height; y++)
+	{
+	    float *row = g->d1 + g->pitch * (y + 1) + 1;
+
+	    sy = (g->y + (2 * y + 1) * g->outputHeight / (2 * g->height)) *
+		 height / s->height;
+	    sy = MIN (sy, height - 1);
+
+	    for (x = 0; x < g->width; x++)
+	    {
+		sx = (g->x + (2 * x + 1) * g->outputWidth / (2 * g->width)) *
+		     width / s->width;
+		sx = MIN (sx, width - 1);
+
+		row[x] += h->d[sy * width + sx];
+	    }
+	}
+    }
+}
+
+/* A value that is not a number would stay in the grid for good and
+   spread to every cell through the stencil, so input carrying one is
+   dropped. Returns FALSE for such a value, anything else is clamped to
+   the range the surface keeps its heights in. */
+static Bool
+frostShmValue (CompScreen *s,
+	       float	  *v)
+{
+    FROST_SCREEN (s);
+
+    if (!isfinite (*v))
+    {
+	if (!fs->shmInvalidWarned)
+	    compLogMessage ("frost", CompLogLevelWarn,
+			    "dropping shared memory input that is not "
+			    "a number");
+
+	fs->shmInvalidWarned = TRUE;
+
+	return FALSE;
+    }
+
+    CLAMP (*v, -1.0f, 1.0f);
+
+    return TRUE;
+}
+
+/* consume everything producers completed since the last frame */
+static void
+frostConsumeShm (CompScreen *s)
+{
+    FrostShm	    *shm;
+    FrostShmHeights *h;
+    XPoint	    p[FROST_SHM_SLOT_POINTS];
+    unsigned int    head, seq, heightSeq, type, n, width, height, i;
+    float	    amp;
+
+    FROST_SCREEN (s);
+
+    shm = fs->shm;
+
+    head = shm->head;
+    __sync_synchronize ();
+
+    /* producers lapped us, the oldest slots are gone */
+    if ((int) (head - fs->shmTail) > FROST_SHM_SLOTS)
+	fs->shmTail = head - FROST_SHM_SLOTS;
+
+    while (fs->shmTail != head)
+    {
+	FrostShmSlot *slot = &shm->slot[fs->shmTail % FROST_SHM_SLOTS];
+
+	seq = slot->seq;
+	__sync_synchronize ();
+
+	if (seq != 2 * fs->shmTail + 2)
+	{
+	    /* still being written, try again next frame */
+	    if ((int) (seq - (2 * fs->shmTail + 2)) < 0)
+		break;
+
+	    fs->shmTail++;
+	    continue;
+	}
+
+	type = slot->type;
+	amp  = slot->amplitude;
+	n    = MIN (slot->n, FROST_SHM_SLOT_POINTS);
+
+	memcpy (p, slot->p, sizeof (XPoint) * n);
+
+	/* only batches that weren't overwritten while copied count */
+	__sync_synchronize ();
+	if (slot->seq == seq && n && frostShmValue (s, &amp))
+	    frostVertices (s, type == FROST_SHM_LINES ? GL_LINES : GL_POINTS,
+			   p, n, amp);
+
+	fs->shmTail++;
+    }
+
+    heightSeq = shm->heightSeq;
+    if (heightSeq != fs->shmHeightSeq)
+    {
+	h = &shm->heights[heightSeq & 1];
+
+	__sync_synchronize ();
+	seq = h->seq;
+	__sync_synchronize ();
+
+	/* a delta torn by the producer moving on to the buffer is retried
+	   next frame, by then a newer one is published */
+	if (seq != 2 * heightSeq + 2)
+	    return;
+
+	width  = MIN (h->width, FROST_SHM_HEIGHT_SIZE);
+	height = MIN (h->height, FROST_SHM_HEIGHT_SIZE);
+
+	memcpy (fs->shmHeights->d, h->d, sizeof (float) * width * height);
+
+	__sync_synchronize ();
+	if (h->seq != seq)
+	    return;
+
+	fs->shmHeightSeq = heightSeq;
+
+	for (i = 0; i < width * height; i++)
+	    if (!frostShmValue (s, &fs->shmHeights->d[i]))
+		return;
+
+	fs->shmHeights->width  = width;
+	fs->shmHeights->height = height;
+
+	frostShmHeights (s);
+    }
+}
+
+/* take the given number of simulation steps on every grid, the swept
+   sector of the wiper is applied once before them */
+static void
+frostStepGrids (CompScreen *s,
+		int	   steps)
+{
+    int i, j;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *g = &fs->grids[i];
+
+	if (steps && g->count)
+	    fs->generation++;
+
+	if (steps && fs->wipe && (g->count || g->ice))
+	    frostWipe (s, g);
+
+	for (j = 0; j < steps; j++)
+	{
+	    if (g->count)
+	    {
+		g->count -= fd->stepFreeze;
+		if (g->count < 0)
+		    g->count = 0;
+
+		frostUpdate (s, g);
+	    }
+
+	    /* ice grows in the same step, on its active tiles only */
+	    if (g->iceActive)
+		frostIceStep (g);
+	}
+    }
+
+    /* a wipe waits for the next frame that has a step to take */
+    if (steps)
+	fs->wipe = FALSE;
+}
+
+static void
+frostPreparePaintScreen (CompScreen *s,
+			 int	    msSinceLastPaint)
+{
+    Bool active = FALSE, frost;
+    int	 i, steps;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    if (fd->traceFd >= 0)
+	gettimeofday (&fs->paintStart, NULL);
+
+    if (fs->shm)
+	frostConsumeShm (s);
+
+    frost = fd->opt[FROST_DISPLAY_OPTION_FROST_MODE].value.b;
+
+    /* idle grids are neither stepped nor wiped, fully frozen ones have
+       no active tiles but still melt under a running wiper */
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *g = &fs->grids[i];
+
+	if (frost && !g->ice && g->data)
+	    frostInitIce (g);
+	else if (!frost && g->ice)
+	    frostFiniIce (g);
+
+	active |= g->count > 0 || g->iceActive > 0 || (fs->wiper && g->ice);
+    }
+
+    if (active)
+    {
+	/* a fixed step keeps the simulation independent of the frame
+	   rate, long frames drop the steps beyond STEP_MAX */
+	fs->stepTime += msSinceLastPaint;
+
+	steps = fs->stepTime / STEP_MS;
+	fs->stepTime -= steps * STEP_MS;
+	steps = MIN (steps, STEP_MAX);
+
+	if (fs->wiper)
+	{
+	    float step, angle0, angle1;
+	    Bool  wipe = FALSE;
+
+	    step = fs->wiperSpeed * msSinceLastPaint / 20.0f;
+
+	    if (fs->wiperSpeed > 0.0f)
+	    {
+		if (fs->wiperAngle < 180.0f)
+		{
+		    angle0 = fs->wiperAngle;
+
+		    fs->wiperAngle += step;
+		    fs->wiperAngle = MIN (fs->wiperAngle, 180.0f);
+
+		    angle1 = fs->wiperAngle;
+
+		    wipe = TRUE;
+		}
+	    }
+	    else
+	    {
+		if (fs->wiperAngle > 0.0f)
+		{
+		    angle1 = fs->wiperAngle;
+
+		    fs->wiperAngle += step;
+		    fs->wiperAngle = MAX (fs->wiperAngle, 0.0f);
+
+		    angle0 = fs->wiperAngle;
+
+		    wipe = TRUE;
+		}
+	    }
+
+	    /* turn around at either end, the sweep itself is applied
+	       analytically in the next simulation step */
+	    if (fs->wiperAngle >= 180.0f)
+		fs->wiperSpeed = -2.5f;
+	    else if (fs->wiperAngle <= 0.0f)
+		fs->wiperSpeed = 2.5f;
+
+	    if (wipe)
+	    {
+		if (fs->wipe)
+		{
+		    fs->wipeAngle0 = MIN (fs->wipeAngle0, angle0);
+		    fs->wipeAngle1 = MAX (fs->wipeAngle1, angle1);
+		}
+		else
+		{
+		    fs->wipeAngle0 = angle0;
+		    fs->wipeAngle1 = angle1;
+		    fs->wipe	   = TRUE;
+		}
+	    }
+	}
+
+	if (steps && fd->traceFd >= 0)
+	{
+	    FrostTraceRecord r;
+	    struct timeval   start;
+
+	    memset (&r, 0, sizeof (r));
+
+	    r.kind = TRACE_STEP;
+	    r.a	   = steps;
+
+	    if (fs->wipe)
+	    {
+		r.flags = TRACE_WIPE;
+		r.f0	= fs->wipeAngle0;
+		r.f1	= fs->wipeAngle1;
+	    }
+
+	    gettimeofday (&start, NULL);
+	    frostStepGrids (s, steps);
+	    r.b = frostElapsed (&start);
+
+	    frostTrace (s, &r, NULL, 0);
+	}
+	else
+	{
+	    frostStepGrids (s, steps);
+	}
+
+	for (i = 0; i < fs->nGrid; i++)
+	    if (fs->grids[i].ice)
+		frostUploadIce (s, &fs->grids[i]);
+    }
+    else
+    {
+	fs->stepTime = 0;
+    }
+
+    UNWRAP (fs, s, preparePaintScreen);
+    (*s->preparePaintScreen) (s, msSinceLastPaint);
+    WRAP (fs, s, preparePaintScreen, frostPreparePaintScreen);
+}
+
+static void
+frostDonePaintScreen (CompScreen *s)
+{
+    int i;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    /* window draws outside paintOutput leave their state until here */
+    frostFlushState (s);
+
+    if (fd->traceFd >= 0 && fs->paintStart.tv_sec)
+    {
+	FrostTraceRecord r;
+
+	memset (&r, 0, sizeof (r));
+
+	r.kind = TRACE_PAINT;
+	r.b    = frostElapsed (&fs->paintStart);
+
+	frostTrace (s, &r, NULL, 0);
+
+	fs->paintStart.tv_sec = 0;
+    }
+
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *g = &fs->grids[i];
+	REGION	  region;
+
+	region.rects	= &region.extents;
+	region.numRects = 1;
+
+	region.extents.x1 = g->x;
+	region.extents.y1 = g->y;
+	region.extents.x2 = g->x + g->outputWidth;
+	region.extents.y2 = g->y + g->outputHeight;
+
+	/* without ripples only the rows where the ice changed */
+	if (!g->count)
+	{
+	    if (g->iceDamageY0 >= g->iceDamageY1)
+		continue;
+
+	    region.extents.y1 = g->y + g->iceDamageY0 * g->outputHeight /
+				g->height;
+	    region.extents.y2 = g->y + (g->iceDamageY1 * g->outputHeight +
+					g->height - 1) / g->height;
+	}
+
+	g->iceDamageY0 = g->height;
+	g->iceDamageY1 = 0;
+
+	damageScreenRegion (s, &region);
+    }
+
+    UNWRAP (fs, s, donePaintScreen);
+    (*s->donePaintScreen) (s);
+    WRAP (fs, s, donePaintScreen, frostDonePaintScreen);
+}
+
+static void
+frostHandleMotionEvent (CompDisplay *d,
+			Window	    root)
+{
+    CompScreen *s;
+
+    s = findScreenAtDisplay (d, root);
+    if (s)
+    {
+	FROST_SCREEN (s);
+
+	if (fs->grabIndex)
+	{
+	    XPoint p[2];
+
+	    p[0].x = frostLastPointerX;
+	    p[0].y = frostLastPointerY;
+
+	    p[1].x = frostLastPointerX = pointerX;
+	    p[1].y = frostLastPointerY = pointerY;
+
+	    frostVertices (s, GL_LINES, p, 2, 0.2f);
+
+	    damageScreen (s);
+	}
+    }
+}
+
+static Bool
+frostInitiate (CompDisplay     *d,
+	       CompAction      *action,
+	       CompActionState state,
+	       CompOption      *option,
+	       int	       nOption)
+{
+    CompScreen   *s;
+    unsigned int ui;
+    Window	 root, child;
+    int	         xRoot, yRoot, i;
+
+    for (s = d->screens; s; s = s->next)
+    {
+	FROST_SCREEN (s);
+
+	if (otherScreenGrabExist (s, "frost", NULL))
+	    continue;
+
+	if (!fs->grabIndex)
+	    fs->grabIndex = pushScreenGrab (s, None, "frost");
+
+	if (XQueryPointer (d->display, s->root, &root, &child, &xRoot, &yRoot,
+			   &i, &i, &ui))
+	{
+	    XPoint p;
+
+	    p.x = frostLastPointerX = xRoot;
+	    p.y = frostLastPointerY = yRoot;
+
+	    frostVertices (s, GL_POINTS, &p, 1, 0.8f);
+
+	    damageScreen (s);
+	}
+    }
+
+    if (state & CompActionStateInitButton)
+	action->state |= CompActionStateTermButton;
+
+    if (state & CompActionStateInitKey)
+	action->state |= CompActionStateTermKey;
+
+    return FALSE;
+}
+
+static Bool
+frostTerminate (CompDisplay	*d,
+		CompAction	*action,
+		CompActionState state,
+		CompOption	*option,
+		int		nOption)
+{
+    CompScreen *s;
+
+    for (s = d->screens; s; s = s->next)
+    {
+	FROST_SCREEN (s);
+
+	if (fs->grabIndex)
+	{
+	    removeScreenGrab (s, fs->grabIndex, 0);
+	    fs->grabIndex = 0;
+	}
+    }
+
+    return FALSE;
+}
+
+static Bool
+frostToggleRain (CompDisplay     *d,
+		 CompAction      *action,
+		 CompActionState state,
+		 CompOption      *option,
+		 int	         nOption)
+{
+    CompScreen *s;
+
+    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root", 0));
+    if (s)
+    {
+	FROST_SCREEN (s);
+
+	fs->rain = !fs->rain;
+
+	frostUpdateRainTimeout (d);
+    }
+
+    return FALSE;
+}
+
+static Bool
+frostToggleWiper (CompDisplay     *d,
+		  CompAction      *action,
+		  CompActionState state,
+		  CompOption      *option,
+		  int	          nOption)
+{
+    CompScreen *s;
+
+    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root", 0));
+    if (s)
+    {
+	FROST_SCREEN (s);
+
+	fs->wiper = !fs->wiper;
+	if (fs->wiper && fs->wiperSpeed == 0.0f)
+	    fs->wiperSpeed = 2.5f;
+    }
+
+    return FALSE;
+}
+
+static Bool
+frostTitleWave (CompDisplay     *d,
+		CompAction      *action,
+		CompActionState state,
+		CompOption      *option,
+		int	        nOption)
+{
+    CompWindow *w;
+    int	       xid;
+
+    xid = getIntOptionNamed (option, nOption, "window", d->activeWindow);
+
+    w = findWindowAtDisplay (d, xid);
+    if (w)
+    {
+	XPoint p[2];
+
+	p[0].x = w->attrib.x - w->input.left;
+	p[0].y = w->attrib.y - w->input.top / 2;
+
+	p[1].x = w->attrib.x + w->width + w->input.right;
+	p[1].y = p[0].y;
+
+	frostVertices (w->screen, GL_LINES, p, 2, 0.15f);
+
+	damageScreen (w->screen);
+    }
+
+    return FALSE;
+}
+
+static Bool
+frostPoint (CompDisplay     *d,
+	    CompAction      *action,
+	    CompActionState state,
+	    CompOption      *option,
+	    int	            nOption)
+{
+    CompScreen *s;
+    int	       xid;
+
+    xid = getIntOptionNamed (option, nOption, "root", 0);
+
+    s = findScreenAtDisplay (d, xid);
+    if (s)
+    {
+	XPoint p;
+	float  amp;
+
+	p.x = getIntOptionNamed (option, nOption, "x", s->width / 2);
+	p.y = getIntOptionNamed (option, nOption, "y", s->height / 2);
+
+	amp = getFloatOptionNamed (option, nOption, "amplitude", 0.5f);
+
+	frostVertices (s, GL_POINTS, &p, 1, amp);
+
+	damageScreen (s);
+    }
+
+    return FALSE;
+}
+
+static Bool
+frostLine (CompDisplay     *d,
+	   CompAction      *action,
+	   CompActionState state,
+	   CompOption      *option,
+	   int	           nOption)
+{
+    CompScreen *s;
+    int	       xid;
+
+    xid = getIntOptionNamed (option, nOption, "root", 0);
+
+    s = findScreenAtDisplay (d, xid);
+    if (s)
+    {
+	XPoint p[2];
+	float  amp;
+
+	p[0].x = getIntOptionNamed (option, nOption, "x0", s->width / 4);
+	p[0].y = getIntOptionNamed (option, nOption, "y0", s->height / 2);
+
+	p[1].x = getIntOptionNamed (option, nOption, "x1",
+				    s->width - s->width / 4);
+	p[1].y = getIntOptionNamed (option, nOption, "y1", s->height / 2);
+
+
+	amp = getFloatOptionNamed (option, nOption, "amplitude", 0.25f);
+
+	frostVertices (s, GL_LINES, p, 2, amp);
+
+	damageScreen (s);
+    }
+
+    return FALSE;
+}
+
+static CompListValue *
+frostListOptionNamed (CompOption *option,
+		      int	 nOption,
+		      const char *name)
+{
+    while (nOption--)
+    {
+	if (option->type == CompOptionTypeList && !strcmp (option->name, name))
+	    return &option->value.list;
+
+	option++;
+    }
+
+    return NULL;
+}
+
+/* element i of a number list, lists that run short repeat their last
+   element */
+static float
+frostListFloat (CompListValue *list,
+		int	      i,
+		float	      defaultValue)
+{
+    if (!list || !list->nValue)
+	return defaultValue;
+
+    i = MIN (i, list->nValue - 1);
+
+    if (list->type == CompOptionTypeFloat)
+	return list->value[i].f;
+
+    return list->value[i].i;
+}
+
+/* element i of a coordinate list, clamped to what an XPoint holds */
+static short
+frostListCoord (CompListValue *list,
+		int	      i)
+{
+    float v;
+
+    v = frostListFloat (list, i, 0.0f);
+    if (isnan (v))
+	return 0;
+
+    CLAMP (v, SHRT_MIN, SHRT_MAX);
+
+    return v;
+}
+
+/* Inject a whole batch of points, segments or a line strip with one
+   action and one pass through frostAmplitudeVertices. Amplitudes are
+   given per point and interpolated along segments. */
+static Bool
+frostBatch (CompDisplay     *d,
+	    CompAction      *action,
+	    CompActionState state,
+	    CompOption      *option,
+	    int	            nOption)
+{
+    CompScreen	  *s;
+    CompListValue *xs, *ys, *amplitudes;
+    XPoint	  *p;
+    GLenum	  type;
+    float	  *amp, defaultAmp;
+    char	  *mode;
+    Bool	  strip;
+    int		  i, j, n, nPrimitive, size;
+
+    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root",
+						   0));
+    if (!s)
+	return FALSE;
+
+    xs = frostListOptionNamed (option, nOption, "xs");
+    ys = frostListOptionNamed (option, nOption, "ys");
+    if (!xs || !ys)
+	return FALSE;
+
+    amplitudes = frostListOptionNamed (option, nOption, "amplitudes");
+    defaultAmp = getFloatOptionNamed (option, nOption, "amplitude", 0.5f);
+
+    mode = getStringOptionNamed (option, nOption, "mode", "points");
+
+    n = MIN (xs->nValue, ys->nValue);
+
+    strip = !strcmp (mode, "strip");
+    if (strip)
+    {
+	type	   = GL_LINES;
+	size	   = 2;
+	nPrimitive = MAX (n - 1, 0);
+    }
+    else if (!strcmp (mode, "segments"))
+    {
+	type	   = GL_LINES;
+	size	   = 2;
+	nPrimitive = n / 2;
+    }
+    else
+    {
+	type	   = GL_POINTS;
+	size	   = 1;
+	nPrimitive = n;
+    }
+
+    if (!nPrimitive)
+	return FALSE;
+
+    n = size * nPrimitive;
+
+    p = malloc ((sizeof (XPoint) + sizeof (float)) * n);
+    if (!p)
+	return FALSE;
+
+    amp = amplitudes ? (float *) (p + n) : NULL;
+
+    for (i = 0; i < n; i++)
+    {
+	/* strips share every inner point between two segments */
+	j = strip ? i / 2 + i % 2 : i;
+
+	p[i].x = frostListCoord (xs, j);
+	p[i].y = frostListCoord (ys, j);
+
+	if (amp)
+	    amp[i] = frostListFloat (amplitudes, j, defaultAmp);
+    }
+
+    frostAmplitudeVertices (s, type, p, amp, n, defaultAmp);
+
+    free (p);
+
+    damageScreen (s);
+
+    return FALSE;
+}
+
+/* Feed a recorded trace back through the simulation of one screen
+   without painting, starting from still grids. Only the records of the
+   screen with the same number are used and the time the steps took is
+   logged next to the time they took when recorded. */
+static Bool
+frostReplay (CompDisplay     *d,
+	     CompAction	     *action,
+	     CompActionState state,
+	     CompOption	     *option,
+	     int	     nOption)
+{
+    CompScreen	     *s;
+    FrostTraceRecord r;
+    FrostTraceReader reader;
+    const void	     *points, *amplitudes;
+    void	     *map;
+    struct stat	     st;
+    struct timeval   start;
+    char	     *path;
+    int		     i, file, usec, result;
+    int		     nVertices = 0, nStep = 0, recorded = 0;
+    frostScreen	     *fs;
+
+    FROST_DISPLAY (d);
+
+    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root",
+						   0));
+    if (!s || !s->fragmentProgram)
+	return FALSE;
+
+    path = getStringOptionNamed (option, nOption, "file",
+				 fd->opt[FROST_DISPLAY_OPTION_TRACE_FILE].value.s);
+    if (!path || !*path)
+	return FALSE;
+
+    /* the trace being recorded may be the one replayed */
+    if (fd->traceFd >= 0)
+	frostFlushTrace (d);
+
+    file = open (path, O_RDONLY);
+    if (file < 0)
+    {
+	compLogMessage ("frost", CompLogLevelWarn,
+			"couldn't open trace file %s", path);
+	return FALSE;
+    }
+
+    map = MAP_FAILED;
+    if (!fstat (file, &st) && st.st_size >= sizeof (r))
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    close (file);
+
+    if (map == MAP_FAILED)
+	return FALSE;
+
+    fs = GET_FROST_SCREEN (s, fd);
+
+    /* fresh grids, and nothing that happens meanwhile is recorded */
+    frostFiniGrids (s);
+    frostReset (s);
+
+    if (fd->opt[FROST_DISPLAY_OPTION_FROST_MODE].value.b)
+	for (i = 0; i < fs->nGrid; i++)
+	    frostInitIce (&fs->grids[i]);
+
+    fs->wipe = FALSE;
+
+    fd->traceReplay = TRUE;
+
+    gettimeofday (&start, NULL);
+
+    frostTraceBegin (&reader, map, st.st_size);
+
+    while ((result = frostTraceNext (&reader, &r, &points,
+					   &amplitudes)) > 0)
+    {
+	if (r.kind == TRACE_VERTICES)
+	{
+	    XPoint *v;
+	    float  *amp = NULL;
+
+	    if (r.screen != s->screenNum)
+		continue;
+
+	    /* points and amplitudes may not be aligned in the file */
+	    v = malloc ((sizeof (XPoint) + sizeof (float)) * r.b);
+	    if (v)
+	    {
+		memcpy (v, points, sizeof (XPoint) * r.b);
+
+		if (amplitudes)
+		{
+		    amp = (float *) (v + r.b);
+		    memcpy (amp, amplitudes, sizeof (float) * r.b);
+		}
+
+		frostAmplitudeVertices (s, r.a, v, amp, r.b, r.f0);
+		free (v);
+	    }
+
+	    nVertices++;
+	}
+	else if (r.kind == TRACE_STEP && r.screen == s->screenNum)
+	{
+	    if (r.flags & TRACE_WIPE)
+	    {
+		fs->wipe       = TRUE;
+		fs->wipeAngle0 = r.f0;
+		fs->wipeAngle1 = r.f1;
+	    }
+
+	    frostStepGrids (s, r.a);
+
+	    recorded += r.b;
+	    nStep++;
+	}
+    }
+
+    /* include whatever the GPU path still has queued */
+    glFinish ();
+    usec = frostElapsed (&start);
+
+    fd->traceReplay = FALSE;
+
+    munmap (map, st.st_size);
+
+    if (result < 0)
+	compLogMessage ("frost", CompLogLevelWarn,
+			"trace file %s is not a valid trace", path);
+
+    compLogMessage ("frost", CompLogLevelInfo,
+		    "replayed %d disturbances and %d frames from %s in "
+		    "%.2f ms, recorded steps took %.2f ms",
+		    nVertices, nStep, path, usec / 1000.0f,
+		    recorded / 1000.0f);
+
+    for (i = 0; i < fs->nGrid; i++)
+	if (fs->grids[i].ice)
+	    frostUploadIce (s, &fs->grids[i]);
+
+    damageScreen (s);
+
+    return FALSE;
+}
+
+static void
+frostHandleEvent (CompDisplay *d,
+		  XEvent      *event)
+{
+    CompScreen *s;
+
+    FROST_DISPLAY (d);
+
+    switch (event->type) {
+    case ButtonPress:
+	s = findScreenAtDisplay (d, event->xbutton.root);
+	if (s)
+	{
+	    FROST_SCREEN (s);
+
+	    if (fs->grabIndex)
+	    {
+		XPoint p;
+
+		p.x = pointerX;
+		p.y = pointerY;
+
+		frostVertices (s, GL_POINTS, &p, 1, 0.8f);
+		damageScreen (s);
+	    }
+	}
+	break;
+    case EnterNotify:
+    case LeaveNotify:
+	frostHandleMotionEvent (d, event->xcrossing.root);
+	break;
+    case MotionNotify:
+	frostHandleMotionEvent (d, event->xmotion.root);
+    default:
+	break;
+    }
+
+    UNWRAP (fd, d, handleEvent);
+    (*d->handleEvent) (d, event);
+    WRAP (fd, d, handleEvent, frostHandleEvent);
+}
+
+/* per step constants derived from the physics options */
+static void
+frostUpdatePhysics (CompDisplay *d)
+{
+    float halfLife, speed;
+
+    FROST_DISPLAY (d);
+
+    fd->cellScale = (float) fd->opt[FROST_DISPLAY_OPTION_RESOLUTION].value.i /
+		    TEXTURE_SIZE;
+
+    /* the same wave spans fewer cells on coarse grids, so the height
+       difference between neighbours grows and the normals have to be
+       scaled down to look the same */
+    fd->normalScale = 1.5f * fd->cellScale;
+
+    /* K * 1.6 is the propagation the simulation always had, it grows with
+       the square of the cells a wave crosses per step. Past the 0.5 the
+       stencil takes stably, steps are split, n sub-steps each propagate
+       1 / (n * n) as far */
+    speed = K * 1.6f * fd->opt[FROST_DISPLAY_OPTION_WAVE_SPEED].value.f;
+    speed *= fd->cellScale * fd->cellScale;
+
+    fd->subSteps  = MAX ((int) ceilf (sqrtf (speed / 0.5f)), 1);
+    fd->stepSpeed = speed / (fd->subSteps * fd->subSteps);
+
+    halfLife = fd->opt[FROST_DISPLAY_OPTION_DAMPING].value.i;
+    fd->stepFade = powf (0.5f, STEP_MS / (halfLife * fd->subSteps));
+
+    fd->stepFreeze = COUNT_MAX * STEP_MS / 1000.0f *
+		     fd->opt[FROST_DISPLAY_OPTION_FREEZE_RATE].value.f + 0.5f;
+    fd->stepFreeze = MAX (fd->stepFreeze, 1);
+}
+
+/* Gaussian brush that falls to one half at the brush radius, rebuilt
+   whenever the radius changes */
+static Bool
+frostUpdateBrush (CompDisplay *d)
+{
+    FROST_DISPLAY (d);
+
+    return frostBuildBrush (&fd->brush,
+			    fd->opt[FROST_DISPLAY_OPTION_BRUSH_RADIUS].value.f *
+			    fd->cellScale);
+}
+
+static int
+frostGetGrids (CompScreen    *s,
+	       FrostGridInfo *info,
+	       int	     nInfo)
+{
+    int i;
+
+    FROST_SCREEN (s);
+
+    for (i = 0; i < MIN (nInfo, fs->nGrid); i++)
+    {
+	frostGrid     *g = &fs->grids[i];
+	FrostGridInfo *gi = &info[i];
+
+	gi->x	   = g->x;
+	gi->y	   = g->y;
+	gi->width  = g->outputWidth;
+	gi->height = g->outputHeight;
+
+	gi->texture    = g->texture[TINDEX (g, 0)];
+	gi->target     = fs->target;
+	gi->heightOnly = g->heightOnly;
+
+	/* same planes frostTexGen sets up */
+	gi->sPlane[1] = gi->sPlane[2] = 0.0f;
+	gi->sPlane[0] = g->tx / (GLfloat) g->outputWidth;
+	gi->sPlane[3] = -g->x * gi->sPlane[0];
+
+	gi->tPlane[0] = gi->tPlane[2] = 0.0f;
+	gi->tPlane[1] = g->ty / (GLfloat) g->outputHeight;
+	gi->tPlane[3] = -g->y * gi->tPlane[1];
+
+	gi->active = g->count > 0;
+    }
+
+    return fs->nGrid;
+}
+
+static void
+frostGetActiveRegion (CompScreen *s,
+		      Region	 region)
+{
+    XRectangle rect;
+    int	       i;
+
+    FROST_SCREEN (s);
+
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *g = &fs->grids[i];
+
+	if (!g->count)
+	    continue;
+
+	rect.x	    = g->x;
+	rect.y	    = g->y;
+	rect.width  = g->outputWidth;
+	rect.height = g->outputHeight;
+
+	XUnionRectWithRegion (&rect, region, region);
+    }
+}
+
+static unsigned int
+frostGetGeneration (CompScreen *s)
+{
+    FROST_SCREEN (s);
+
+    return fs->generation;
+}
+
+static FrostFunctions frostFunctions = {
+    frostGetGrids,
+    frostGetActiveRegion,
+    frostGetGeneration
+};
+
+static CompOption *
+frostGetDisplayOptions (CompPlugin  *plugin,
+			CompDisplay *display,
+			int	    *count)
+{
+    FROST_DISPLAY (display);
+
+    *count = NUM_OPTIONS (fd);
+    return fd->opt;
+}
+
+static Bool
+frostSetDisplayOption (CompPlugin      *plugin,
+		       CompDisplay     *display,
+		       const char      *name,
+		       CompOptionValue *value)
+{
+    CompOption *o;
+    int	       index;
+
+    FROST_DISPLAY (display);
+
+    o = compFindOption (fd->opt, NUM_OPTIONS (fd), name, &index);
+    if (!o)
+	return FALSE;
+
+    switch (index) {
+    case FROST_DISPLAY_OPTION_OFFSET_SCALE:
+	if (compSetFloatOption (o, value))
+	{
+	    fd->offsetScale = o->value.f * 50.0f;
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_RAIN_DELAY:
+	if (compSetIntOption (o, value))
+	{
+	    if (fd->rainHandle)
+	    {
+		compRemoveTimeout (fd->rainHandle);
+		fd->rainHandle = compAddTimeout (value->i,
+						 (float)value->i * 1.2,
+						 frostRainTimeout, display);
+	    }
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_WAVE_SPEED:
+    case FROST_DISPLAY_OPTION_FREEZE_RATE:
+	if (compSetFloatOption (o, value))
+	{
+	    frostUpdatePhysics (display);
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_DAMPING:
+	if (compSetIntOption (o, value))
+	{
+	    frostUpdatePhysics (display);
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_FROST_MODE:
+	if (compSetBoolOption (o, value))
+	{
+	    CompScreen *s;
+
+	    /* ice is set up or torn down in the next preparePaintScreen */
+	    for (s = display->screens; s; s = s->next)
+		damageScreen (s);
+
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_RESOLUTION:
+	if (compSetIntOption (o, value))
+	{
+	    CompScreen *s;
+
+	    frostUpdatePhysics (display);
+	    frostUpdateBrush (display);
+
+	    /* grids are resampled to the new size */
+	    for (s = display->screens; s; s = s->next)
+	    {
+		frostReset (s);
+		damageScreen (s);
+	    }
+
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_BRUSH_RADIUS:
+	if (compSetFloatOption (o, value))
+	{
+	    frostUpdateBrush (display);
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_TRACE_FILE:
+	if (compSetStringOption (o, value))
+	{
+	    frostOpenTrace (display);
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_SHM_NAME:
+	if (compSetStringOption (o, value))
+	{
+	    CompScreen *s;
+
+	    for (s = display->screens; s; s = s->next)
+		frostOpenShm (s);
+
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_RAIN_SEED:
+	if (compSetIntOption (o, value))
+	{
+	    CompScreen *s;
+
+	    for (s = display->screens; s; s = s->next)
+		frostSeedRain (s, o->value.i);
+
+	    return TRUE;
+	}
+	break;
+    case FROST_DISPLAY_OPTION_ABI:
+    case FROST_DISPLAY_OPTION_INDEX:
+	/* read only, other plugins find the function table through them */
+	break;
+    default:
+	return compSetDisplayOption (display, o, value);
+    }
+
+    return FALSE;
+}
+
+static const CompMetadataOptionInfo frostDisplayOptionInfo[] = {
+    { "initiate_key", "key", 0, frostInitiate, frostTerminate },
+    { "toggle_rain_key", "key", 0, frostToggleRain, 0 },
+    { "toggle_wiper_key", "key", 0, frostToggleWiper, 0 },
+    { "offset_scale", "float", "<min>0</min>", 0, 0 },
+    { "rain_delay", "int", "<min>1</min>", 0, 0 },
+    { "title_wave", "bell", 0, frostTitleWave, 0 },
+    { "point", "action", 0, frostPoint, 0 },
+    { "line", "action", 0, frostLine, 0 },
+    { "rain_seed", "int", "<min>0</min>", 0, 0 },
+    { "brush_radius", "float", "<min>0.5</min>", 0, 0 },
+    { "huge_pages", "bool", 0, 0, 0 },
+    { "height_only", "bool", 0, 0, 0 },
+    { "normal_mode", "int", RESTOSTRING (0, NORMAL_MODE_LAST), 0, 0 },
+    { "wave_speed", "float", "<min>0.1</min><max>1.5</max>", 0, 0 },
+    { "damping", "int", "<min>50</min>", 0, 0 },
+    { "freeze_rate", "float", "<min>0.05</min>", 0, 0 },
+    { "frost_mode", "bool", 0, 0, 0 },
+    { "post_pass", "bool", 0, 0, 0 },
+    { "snapshot", "bool", 0, 0, 0 },
+    { "snapshot_quantize", "bool", 0, 0, 0 },
+    { "trace_file", "string", 0, 0, 0 },
+    { "replay", "action", 0, frostReplay, 0 },
+    { "batch", "action", 0, frostBatch, 0 },
+    { "shm_name", "string", 0, 0, 0 },
+    { "abi", "int", 0, 0, 0 },
+    { "index", "int", 0, 0, 0 },
+    { "resolution", "int", "<min>32</min><max>512</max>", 0, 0 }
+};
+
+static Bool
+frostInitDisplay (CompPlugin  *p,
+		  CompDisplay *d)
+{
+    frostDisplay *fd;
+
+    if (!checkPluginABI ("core", CORE_ABIVERSION))
+	return FALSE;
+
+    fd = malloc (sizeof (frostDisplay));
+    if (!fd)
+	return FALSE;
+
+    if (!compInitDisplayOptionsFromMetadata (d,
+					     &frostMetadata,
+					     frostDisplayOptionInfo,
+					     fd->opt,
+					     FROST_DISPLAY_OPTION_NUM))
+    {
+	free (fd);
+	return FALSE;
+    }
+
+    fd->screenPrivateIndex = allocateScreenPrivateIndex (d);
+    if (fd->screenPrivateIndex < 0)
+    {
+	compFiniDisplayOptions (d, fd->opt, FROST_DISPLAY_OPTION_NUM);
+	free (fd);
+	return FALSE;
+    }
+
+    fd->opt[FROST_DISPLAY_OPTION_ABI].value.i   = FROST_ABIVERSION;
+    fd->opt[FROST_DISPLAY_OPTION_INDEX].value.i = functionsPrivateIndex;
+
+    fd->offsetScale = fd->opt[FROST_DISPLAY_OPTION_OFFSET_SCALE].value.f * 50.0f;
+
+    frostUpdatePhysics (d);
+
+    fd->rainHandle  = 0;
+    fd->scratch	    = NULL;
+    fd->scratchSize = 0;
+    fd->normalTable = NULL;
+
+    fd->traceFd	    = -1;
+    fd->traceBuffer = NULL;
+    fd->traceFill   = 0;
+    fd->traceReplay = FALSE;
+
+    frostOpenTrace (d);
+
+    fd->brush.kernel = NULL;
+    if (!frostUpdateBrush (d))
+    {
+	frostCloseTrace (d);
+	freeScreenPrivateIndex (d, fd->screenPrivateIndex);
+	compFiniDisplayOptions (d, fd->opt, FROST_DISPLAY_OPTION_NUM);
+	free (fd);
+	return FALSE;
+    }
+
+    WRAP (fd, d, handleEvent, frostHandleEvent);
+
+    d->base.privates[displayPrivateIndex].ptr   = fd;
+    d->base.privates[functionsPrivateIndex].ptr = &frostFunctions;
+
+    return TRUE;
+}
+
+static void
+frostFiniDisplay (CompPlugin  *p,
+		  CompDisplay *d)
+{
+    FROST_DISPLAY (d);
+
+    freeScreenPrivateIndex (d, fd->screenPrivateIndex);
+
+    UNWRAP (fd, d, handleEvent);
+
+    if (fd->rainHandle)
+	compRemoveTimeout (fd->rainHandle);
+
+    frostCloseTrace (d);
+
+    frostFreeBrush (&fd->brush);
+    free (fd->scratch);
+    free (fd->normalTable);
+
+    compFiniDisplayOptions (d, fd->opt, FROST_DISPLAY_OPTION_NUM);
+
+    free (fd);
+}
+
+/* Simulation state is kept across compositor restarts in a snapshot
+   file, written on screen fini and mapped back and removed on init. */
+#define SNAPSHOT_MAGIC	   0x54535246 /* "FRST" */
+#define SNAPSHOT_VERSION   1
+#define SNAPSHOT_QUANTIZED (1 << 0)
+
+/* keeps every size a grid can claim within an int */
+#define SNAPSHOT_MAX_SIZE 8192
+
+typedef struct _frostSnapshot {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int size;
+
+    /* FNV-1a of everything after the header */
+    unsigned int checksum;
+
+    unsigned int flags;
+    unsigned int target;
+    int		 nGrid;
+
+    int		 rain;
+    unsigned int rainState;
+    int		 wiper;
+    float	 wiperAngle;
+    float	 wiperSpeed;
+} frostSnapshot;
+
+/* followed by texture images or both bordered heightfields, then ice */
+typedef struct _frostSnapshotGrid {
+    int width, height;
+    int count;
+    int tIndex;
+    int textureSize;
+    int heightSize;
+    int iceSize;
+} frostSnapshotGrid;
+
+/* Snapshots only live in directories no other user can write to, the
+   runtime directory or a private one under /tmp that is created on
+   demand and refused when it isn't a 0700 directory we own. */
+static Bool
+frostSnapshotPath (CompScreen *s,
+		   char	      *path,
+		   int	      size)
+{
+    const char  *dir = getenv ("XDG_RUNTIME_DIR");
+    char	dirPath[64];
+    struct stat st;
+
+    if (!dir || !*dir)
+    {
+	snprintf (dirPath, sizeof (dirPath), "/tmp/compiz-frost-%d",
+		  (int) getuid ());
+
+	if (mkdir (dirPath, 0700) && errno != EEXIST)
+	    return FALSE;
+
+	if (lstat (dirPath, &st)	   ||
+	    !S_ISDIR (st.st_mode)	   ||
+	    st.st_uid != getuid ()	   ||
+	    (st.st_mode & (S_IRWXG | S_IRWXO)))
+	    return FALSE;
+
+	dir = dirPath;
+    }
+
+    snprintf (path, size, "%s/compiz-frost-%d", dir, s->screenNum);
+
+    return TRUE;
+}
+
+/* a grid record is only trusted when its sizes are exactly the ones
+   frostSaveSnapshot derives from its dimensions and the header flags */
+static Bool
+frostSnapshotGridValid (const frostSnapshotGrid *sg,
+			Bool			quantize)
+{
+    int cell = quantize ? sizeof (short) : sizeof (float);
+
+    if (sg->width  < 1 || sg->width  > SNAPSHOT_MAX_SIZE ||
+	sg->height < 1 || sg->height > SNAPSHOT_MAX_SIZE)
+	return FALSE;
+
+    if (sg->textureSize &&
+	sg->textureSize != TEXTURE_NUM * sg->width * sg->height * 4)
+	return FALSE;
+
+    if (sg->heightSize &&
+	sg->heightSize != 2 * (sg->width + 2) * (sg->height + 2) * cell)
+	return FALSE;
+
+    if (sg->textureSize && sg->heightSize)
+	return FALSE;
+
+    if (sg->iceSize && sg->iceSize != sg->width * sg->height)
+	return FALSE;
+
+    return TRUE;
+}
+
+static unsigned int
+frostChecksum (const unsigned char *p,
+	       size_t		   n)
+{
+    unsigned int h = 2166136261u;
+
+    while (n--)
+    {
+	h ^= *p++;
+	h *= 16777619u;
+    }
+
+    return h;
+}
+
+/* heights go out row by row without the padding, quantized to 16 bits
+   when asked to */
+static unsigned char *
+frostSaveHeights (unsigned char *p,
+		  frostGrid	*g,
+		  const float	*d,
+		  Bool		quantize)
+{
+    short v;
+    int	  x, y;
+
+    for (y = 0; y < g->height + 2; y++)
+    {
+	const float *row = d - 1 + g->pitch * y;
+
+	if (!quantize)
+	{
+	    memcpy (p, row, sizeof (float) * (g->width + 2));
+	    p += sizeof (float) * (g->width + 2);
+	    continue;
+	}
+
+	for (x = 0; x < g->width + 2; x++)
+	{
+	    v = (short) (row[x] * 32767.0f);
+	    memcpy (p, &v, sizeof (v));
+	    p += sizeof (v);
+	}
+    }
+
+    return p;
+}
+
+static const unsigned char *
+frostLoadHeights (const unsigned char *p,
+		  float		      *dst,
+		  int		      n,
+		  Bool		      quantize)
+{
+    short v;
+    int	  i;
+
+    if (!quantize)
+    {
+	memcpy (dst, p, sizeof (float) * n);
+	return p + sizeof (float) * n;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+	memcpy (&v, p, sizeof (v));
+	dst[i] = v / 32767.0f;
+	p += sizeof (v);
+    }
+
+    return p;
+}
+
+static void
+frostSaveSnapshot (CompScreen *s)
+{
+    frostSnapshot     header;
+    frostSnapshotGrid *sg;
+    unsigned char     *map, *p;
+    char	      path[1024], tmp[1040];
+    Bool	      quantize, textures;
+    int		      i, j, file, size, cell;
+
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
+
+    if (!frostSnapshotPath (s, path, sizeof (path)))
+	return;
 
-    xid = getIntOptionNamed (option, nOption, "root", 0);
+    if (!fd->opt[FROST_DISPLAY_OPTION_SNAPSHOT].value.b || !fs->nGrid)
+    {
+	unlink (path);
+	return;
+    }
 
-    s = findScreenAtDisplay (d, xid);
-    if (s)
+    quantize = fd->opt[FROST_DISPLAY_OPTION_SNAPSHOT_QUANTIZE].value.b;
+    cell     = quantize ? sizeof (short) : sizeof (float);
+
+    /* grids simulated on the GPU only have their state in textures */
+    textures = fs->fbo && fs->program;
+
+    sg = calloc (fs->nGrid, sizeof (frostSnapshotGrid));
+    if (!sg)
+	return;
+
+    size = sizeof (header) + sizeof (frostSnapshotGrid) * fs->nGrid;
+
+    for (i = 0; i < fs->nGrid; i++)
     {
-	XPoint p;
-	float  amp;
+	frostGrid *g = &fs->grids[i];
 
-	p.x = getIntOptionNamed (option, nOption, "x", s->width / 2);
-	p.y = getIntOptionNamed (option, nOption, "y", s->height / 2);
+	sg[i].width  = g->width;
+	sg[i].height = g->height;
+	sg[i].count  = g->count;
+	sg[i].tIndex = g->tIndex;
 
-	amp = getFloatOptionNamed (option, nOption, "amplitude", 0.5f);
+	if (textures && g->texture[0])
+	    sg[i].textureSize = TEXTURE_NUM * g->width * g->height * 4;
+	else if (g->data)
+	    sg[i].heightSize = 2 * (g->width + 2) * (g->height + 2) * cell;
 
-	frostVertices (s, GL_POINTS, &p, 1, amp);
+	if (g->ice)
+	    sg[i].iceSize = g->width * g->height;
 
-	damageScreen (s);
+	size += sg[i].textureSize + sg[i].heightSize + sg[i].iceSize;
     }
 
-    return FALSE;
-}
+    /* a fresh file that can't be a link planted beforehand */
+    snprintf (tmp, sizeof (tmp), "%s.XXXXXX", path);
 
-static Bool
-frostLine (CompDisplay     *d,
-	   CompAction      *action,
-	   CompActionState state,
-	   CompOption      *option,
-	   int	           nOption)
-{
-    CompScreen *s;
-    int	       xid;
+    file = mkstemp (tmp);
+    if (file < 0)
+    {
+	free (sg);
+	return;
+    }
 
-    xid = getIntOptionNamed (option, nOption, "root", 0);
+    map = MAP_FAILED;
+    if (ftruncate (file, size) == 0)
+	map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
 
-    s = findScreenAtDisplay (d, xid);
-    if (s)
+    close (file);
+
+    if (map == MAP_FAILED)
     {
-	XPoint p[2];
-	float  amp;
+	unlink (tmp);
+	free (sg);
+	return;
+    }
 
-	p[0].x = getIntOptionNamed (option, nOption, "x0", s->width / 4);
-	p[0].y = getIntOptionNamed (option, nOption, "y0", s->height / 2);
+    p = map + sizeof (header);
 
-	p[1].x = getIntOptionNamed (option, nOption, "x1",
-				    s->width - s->width / 4);
-	p[1].y = getIntOptionNamed (option, nOption, "y1", s->height / 2);
+    memcpy (p, sg, sizeof (frostSnapshotGrid) * fs->nGrid);
+    p += sizeof (frostSnapshotGrid) * fs->nGrid;
 
+    for (i = 0; i < fs->nGrid; i++)
+    {
+	frostGrid *g = &fs->grids[i];
 
-	amp = getFloatOptionNamed (option, nOption, "amplitude", 0.25f);
+	if (sg[i].textureSize)
+	{
+	    for (j = 0; j < TEXTURE_NUM; j++)
+	    {
+		if (g->texture[j])
+		{
+		    glBindTexture (fs->target, g->texture[j]);
+		    glGetTexImage (fs->target, 0, GL_BGRA, GL_UNSIGNED_BYTE, p);
+		}
+		else
+		{
+		    memset (p, 0, g->width * g->height * 4);
+		}
 
-	frostVertices (s, GL_LINES, p, 2, amp);
+		p += g->width * g->height * 4;
+	    }
 
-	damageScreen (s);
+	    glBindTexture (fs->target, 0);
+	}
+	else if (sg[i].heightSize)
+	{
+	    p = frostSaveHeights (p, g, g->d0, quantize);
+	    p = frostSaveHeights (p, g, g->d1, quantize);
+	}
+
+	if (sg[i].iceSize)
+	{
+	    memcpy (p, g->ice, sg[i].iceSize);
+	    p += sg[i].iceSize;
+	}
     }
 
-    return FALSE;
+    memset (&header, 0, sizeof (header));
+
+    header.magic      = SNAPSHOT_MAGIC;
+    header.version    = SNAPSHOT_VERSION;
+    header.size	      = size;
+    header.flags      = quantize ? SNAPSHOT_QUANTIZED : 0;
+    header.target     = fs->target;
+    header.nGrid      = fs->nGrid;
+    header.rain	      = fs->rain;
+    header.rainState  = fs->rainState;
+    header.wiper      = fs->wiper;
+    header.wiperAngle = fs->wiperAngle;
+    header.wiperSpeed = fs->wiperSpeed;
+    header.checksum   = frostChecksum (map + sizeof (header),
+				       size - sizeof (header));
+
+    memcpy (map, &header, sizeof (header));
+
+    munmap (map, size);
+    free (sg);
+
+    if (rename (tmp, path))
+	unlink (tmp);
 }
 
+/* restore what frostSaveSnapshot left behind onto freshly reset grids,
+   grids that changed size get their heights resampled */
 static void
-frostHandleEvent (CompDisplay *d,
-		  XEvent      *event)
+frostLoadSnapshot (CompScreen *s)
 {
-    CompScreen *s;
+    frostSnapshot	header;
+    frostSnapshotGrid	sg;
+    const unsigned char *map, *p, *grids;
+    struct stat		st;
+    char		path[1024];
+    float		*tmp;
+    Bool		quantize;
+    int			i, j, y, file, n, pitch;
 
-    FROST_DISPLAY (d);
+    FROST_SCREEN (s);
+    FROST_DISPLAY (s->display);
 
-    switch (event->type) {
-    case ButtonPress:
-	s = findScreenAtDisplay (d, event->xbutton.root);
-	if (s)
-	{
-	    FROST_SCREEN (s);
+    if (!frostSnapshotPath (s, path, sizeof (path)))
+	return;
 
-	    if (fs->grabIndex)
-	    {
-		XPoint p;
+    file = open (path, O_RDONLY | O_NOFOLLOW);
+    if (file < 0)
+	return;
 
-		p.x = pointerX;
-		p.y = pointerY;
+    /* a snapshot is only good for one restore */
+    unlink (path);
 
-		frostVertices (s, GL_POINTS, &p, 1, 0.8f);
-		damageScreen (s);
-	    }
-	}
-	break;
-    case EnterNotify:
-    case LeaveNotify:
-	frostHandleMotionEvent (d, event->xcrossing.root);
-	break;
-    case MotionNotify:
-	frostHandleMotionEvent (d, event->xmotion.root);
-    default:
-	break;
+    if (fstat (file, &st)	       ||
+	!S_ISREG (st.st_mode)	       ||
+	st.st_uid != getuid ()	       ||
+	st.st_size < sizeof (header))
+    {
+	close (file);
+	return;
     }
 
-    UNWRAP (fd, d, handleEvent);
-    (*d->handleEvent) (d, event);
-    WRAP (fd, d, handleEvent, frostHandleEvent);
-}
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close (file);
 
-static CompOption *
-frostGetDisplayOptions (CompPlugin  *plugin,
-			CompDisplay *display,
-			int	    *count)
-{
-    FROST_DISPLAY (display);
+    if (map == MAP_FAILED)
+	return;
 
-    *count = NUM_OPTIONS (fd);
-    return fd->opt;
-}
+    memcpy (&header, map, sizeof (header));
 
-static Bool
-frostSetDisplayOption (CompPlugin      *plugin,
-		       CompDisplay     *display,
-		       const char      *name,
-		       CompOptionValue *value)
-{
-    CompOption *o;
-    int	       index;
+    if (header.magic != SNAPSHOT_MAGIC	   ||
+	header.version != SNAPSHOT_VERSION ||
+	header.size != st.st_size	   ||
+	header.nGrid < 0		   ||
+	header.nGrid > (header.size - sizeof (header)) /
+		       sizeof (frostSnapshotGrid) ||
+	header.checksum != frostChecksum (map + sizeof (header),
+					  st.st_size - sizeof (header)))
+    {
+	compLogMessage ("frost", CompLogLevelWarn,
+			"discarding invalid snapshot %s", path);
+	munmap ((void *) map, st.st_size);
+	return;
+    }
 
-    FROST_DISPLAY (display);
+    if (!fd->opt[FROST_DISPLAY_OPTION_SNAPSHOT].value.b)
+    {
+	munmap ((void *) map, st.st_size);
+	return;
+    }
 
-    o = compFindOption (fd->opt, NUM_OPTIONS (fd), name, &index);
-    if (!o)
-	return FALSE;
+    quantize = header.flags & SNAPSHOT_QUANTIZED;
 
-    switch (index) {
-    case FROST_DISPLAY_OPTION_OFFSET_SCALE:
-	if (compSetFloatOption (o, value))
+    grids = map + sizeof (header);
+    p	  = grids + sizeof (frostSnapshotGrid) * header.nGrid;
+
+    for (i = 0; i < header.nGrid; i++)
+    {
+	memcpy (&sg, grids + sizeof (frostSnapshotGrid) * i, sizeof (sg));
+
+	/* the offsets of every later grid depend on these sizes */
+	if (!frostSnapshotGridValid (&sg, quantize) ||
+	    sg.textureSize + sg.heightSize + sg.iceSize >
+	    map + header.size - p)
 	{
-	    fd->offsetScale = o->value.f * 50.0f;
-	    return TRUE;
+	    compLogMessage ("frost", CompLogLevelWarn,
+			    "discarding snapshot %s from grid %d on", path, i);
+	    break;
 	}
-	break;
-    case FROST_DISPLAY_OPTION_RAIN_DELAY:
-	if (compSetIntOption (o, value))
+
+	if (i < fs->nGrid)
 	{
-	    CompScreen *s;
+	    frostGrid *g = &fs->grids[i];
+	    Bool      same = sg.width == g->width && sg.height == g->height;
 
-	    for (s = display->screens; s; s = s->next)
+	    if (sg.textureSize && same && fs->fbo &&
+		header.target == fs->target)
 	    {
-		FROST_SCREEN (s);
-
-		if (!fs->rainHandle)
-		    continue;
+		for (j = 0; j < TEXTURE_NUM; j++)
+		{
+		    if (!g->texture[j])
+			allocTexture (s, g, j);
 
-		compRemoveTimeout (fs->rainHandle);
-		fs->rainHandle = compAddTimeout (value->i,
-						 (float)value->i * 1.2,
-						 frostRainTimeout, s);
-	    }
-	    return TRUE;
-	}
-	break;
-    default:
-	return compSetDisplayOption (display, o, value);
-    }
+		    glBindTexture (fs->target, g->texture[j]);
+		    glTexSubImage2D (fs->target, 0, 0, 0, g->width, g->height,
+				     GL_BGRA, GL_UNSIGNED_BYTE,
+				     p + j * g->width * g->height * 4);
+		}
 
-    return FALSE;
-}
+		glBindTexture (fs->target, 0);
 
-static const CompMetadataOptionInfo frostDisplayOptionInfo[] = {
-    { "initiate_key", "key", 0, frostInitiate, frostTerminate },
-    { "toggle_rain_key", "key", 0, frostToggleRain, 0 },
-    { "toggle_wiper_key", "key", 0, frostToggleWiper, 0 },
-    { "offset_scale", "float", "<min>0</min>", 0, 0 },
-    { "rain_delay", "int", "<min>1</min>", 0, 0 },
-    { "title_wave", "bell", 0, frostTitleWave, 0 },
-    { "point", "action", 0, frostPoint, 0 },
-    { "line", "action", 0, frostLine, 0 }
-};
+		g->tIndex = sg.tIndex % TEXTURE_NUM;
+		g->count  = sg.count;
+	    }
+	    else if (sg.heightSize && g->data)
+	    {
+		n     = (sg.width + 2) * (sg.height + 2);
+		pitch = sg.width + 2;
 
-static Bool
-frostInitDisplay (CompPlugin  *p,
-		  CompDisplay *d)
-{
-    frostDisplay *fd;
+		tmp = malloc (sizeof (float) * n * 2);
+		if (tmp)
+		{
+		    frostLoadHeights (p, tmp, n * 2, quantize);
+
+		    if (same)
+		    {
+			for (y = 0; y < g->height + 2; y++)
+			{
+			    memcpy (g->d0 - 1 + g->pitch * y, tmp + pitch * y,
+				    sizeof (float) * pitch);
+			    memcpy (g->d1 - 1 + g->pitch * y,
+				    tmp + n + pitch * y,
+				    sizeof (float) * pitch);
+			}
+		    }
+		    else
+		    {
+			resampleHeights (g->d0, g->width, g->height, g->pitch,
+					 tmp, sg.width, sg.height, pitch);
+			resampleHeights (g->d1, g->width, g->height, g->pitch,
+					 tmp + n, sg.width, sg.height, pitch);
+		    }
+
+		    free (tmp);
+
+		    g->count = sg.count;
+		}
+	    }
 
-    if (!checkPluginABI ("core", CORE_ABIVERSION))
-	return FALSE;
+	    if (sg.iceSize && same &&
+		fd->opt[FROST_DISPLAY_OPTION_FROST_MODE].value.b &&
+		frostInitIce (g))
+	    {
+		memcpy (g->ice, p + sg.textureSize + sg.heightSize,
+			sg.iceSize);
 
-    fd = malloc (sizeof (frostDisplay));
-    if (!fd)
-	return FALSE;
+		/* let every tile find out whether it still grows */
+		memset (g->iceTiles, ICE_TILE_ACTIVE,
+			g->iceTilesX * g->iceTilesY);
+		g->iceActive = g->iceTilesX * g->iceTilesY;
+	    }
+	}
 
-    if (!compInitDisplayOptionsFromMetadata (d,
-					     &frostMetadata,
-					     frostDisplayOptionInfo,
-					     fd->opt,
-					     FROST_DISPLAY_OPTION_NUM))
-    {
-	free (fd);
-	return FALSE;
+	p += sg.textureSize + sg.heightSize + sg.iceSize;
     }
 
-    fd->screenPrivateIndex = allocateScreenPrivateIndex (d);
-    if (fd->screenPrivateIndex < 0)
+    fs->rainState  = header.rainState;
+    fs->wiper	   = header.wiper;
+    fs->wiperAngle = header.wiperAngle;
+    fs->wiperSpeed = header.wiperSpeed;
+
+    if (header.rain && !fs->rain)
     {
-	compFiniDisplayOptions (d, fd->opt, FROST_DISPLAY_OPTION_NUM);
-	free (fd);
-	return FALSE;
+	fs->rain = TRUE;
+	frostUpdateRainTimeout (s->display);
     }
 
-    fd->offsetScale = fd->opt[FROST_DISPLAY_OPTION_OFFSET_SCALE].value.f * 50.0f;
+    munmap ((void *) map, st.st_size);
+}
 
-    WRAP (fd, d, handleEvent, frostHandleEvent);
+/* create the fragment functions a window without other functions ends
+   up using, so the first ripple does not pay for it */
+static Bool
+frostPrewarm (void *closure)
+{
+    CompScreen	*s = closure;
+    CompTexture texture;
+    int		i, heightOnly;
 
-    d->base.privates[displayPrivateIndex].ptr = fd;
+    FROST_SCREEN (s);
 
-    return TRUE;
-}
+    fs->prewarmHandle = 0;
 
-static void
-frostFiniDisplay (CompPlugin  *p,
-		  CompDisplay *d)
-{
-    FROST_DISPLAY (d);
+    memset (&texture, 0, sizeof (texture));
 
-    freeScreenPrivateIndex (d, fd->screenPrivateIndex);
+    for (i = 0; i < 2; i++)
+    {
+	texture.target = i ? GL_TEXTURE_RECTANGLE_NV : GL_TEXTURE_2D;
 
-    UNWRAP (fd, d, handleEvent);
+	for (heightOnly = 0; heightOnly < 2; heightOnly++)
+	{
+	    getBumpMapFragmentFunction (s, &texture, 1, 0, heightOnly);
+	    getIceFragmentFunction (s, &texture, 2, heightOnly ? 2 : 1);
+	}
 
-    compFiniDisplayOptions (d, fd->opt, FROST_DISPLAY_OPTION_NUM);
+	getIceFragmentFunction (s, &texture, 1, 0);
+    }
 
-    free (fd);
+    return FALSE;
 }
 
 static Bool
@@ -1653,14 +5538,56 @@ frostInitScreen (CompPlugin *p,
 
     fs->grabIndex = 0;
 
+    fs->bumpState.unit = -1;
+    fs->iceState.unit  = -1;
+
+    if (strstr ((const char *) glGetString (GL_EXTENSIONS),
+		"GL_ARB_pixel_buffer_object"))
+    {
+	fs->genBuffers	  = (FrostGenBuffersProc)
+	    (*s->getProcAddress) ((GLubyte *) "glGenBuffersARB");
+	fs->deleteBuffers = (FrostDeleteBuffersProc)
+	    (*s->getProcAddress) ((GLubyte *) "glDeleteBuffersARB");
+	fs->bindBuffer	  = (FrostBindBufferProc)
+	    (*s->getProcAddress) ((GLubyte *) "glBindBufferARB");
+	fs->bufferData	  = (FrostBufferDataProc)
+	    (*s->getProcAddress) ((GLubyte *) "glBufferDataARB");
+	fs->mapBuffer	  = (FrostMapBufferProc)
+	    (*s->getProcAddress) ((GLubyte *) "glMapBufferARB");
+	fs->unmapBuffer	  = (FrostUnmapBufferProc)
+	    (*s->getProcAddress) ((GLubyte *) "glUnmapBufferARB");
+
+	/* fall back to the scratch buffer unless everything is there */
+	if (!fs->genBuffers || !fs->deleteBuffers || !fs->bindBuffer ||
+	    !fs->bufferData || !fs->unmapBuffer)
+	    fs->mapBuffer = NULL;
+    }
+
+    if (strstr ((const char *) glGetString (GL_EXTENSIONS),
+		"GL_EXT_blend_subtract"))
+	fs->blendEquation = (FrostBlendEquationProc)
+	    (*s->getProcAddress) ((GLubyte *) "glBlendEquationEXT");
+
     WRAP (fs, s, preparePaintScreen, frostPreparePaintScreen);
     WRAP (fs, s, donePaintScreen, frostDonePaintScreen);
     WRAP (fs, s, drawWindowTexture, frostDrawWindowTexture);
+    WRAP (fs, s, outputChangeNotify, frostOutputChangeNotify);
+    WRAP (fs, s, paintOutput, frostPaintOutput);
 
     s->base.privates[fd->screenPrivateIndex].ptr = fs;
 
+    frostSeedRain (s, fd->opt[FROST_DISPLAY_OPTION_RAIN_SEED].value.i);
+
     frostReset (s);
 
+    if (s->fragmentProgram)
+    {
+	frostLoadSnapshot (s);
+	frostOpenShm (s);
+
+	fs->prewarmHandle = compAddTimeout (0, 500, frostPrewarm, s);
+    }
+
     return TRUE;
 }
 
@@ -1669,30 +5596,37 @@ frostFiniScreen (CompPlugin *p,
 		 CompScreen *s)
 {
     frostFunction *function, *next;
-    int		  i;
 
     FROST_SCREEN (s);
 
-    if (fs->rainHandle)
-	compRemoveTimeout (fs->rainHandle);
+    frostSaveSnapshot (s);
+    frostCloseShm (s);
 
-    if (fs->wiperHandle)
-	compRemoveTimeout (fs->wiperHandle);
+    if (fs->rain)
+    {
+	fs->rain = FALSE;
+	frostUpdateRainTimeout (s->display);
+    }
+
+    if (fs->prewarmHandle)
+	compRemoveTimeout (fs->prewarmHandle);
 
     if (fs->fbo)
 	(*s->deleteFramebuffers) (1, &fs->fbo);
 
-    for (i = 0; i < TEXTURE_NUM; i++)
-    {
-	if (fs->texture[i])
-	    glDeleteTextures (1, &fs->texture[i]);
-    }
-
     if (fs->program)
 	(*s->deletePrograms) (1, &fs->program);
 
-    if (fs->data)
-	free (fs->data);
+    if (fs->pbo)
+	(*fs->deleteBuffers) (1, &fs->pbo);
+
+    if (fs->postProgram)
+	(*s->deletePrograms) (1, &fs->postProgram);
+
+    if (fs->sceneTexture)
+	glDeleteTextures (1, &fs->sceneTexture);
+
+    frostFiniGrids (s);
 
     function = fs->bumpMapFunctions;
     while (function)
@@ -1704,9 +5638,21 @@ frostFiniScreen (CompPlugin *p,
 	function = next;
     }
 
+    function = fs->iceFunctions;
+    while (function)
+    {
+	destroyFragmentFunction (s, function->handle);
+
+	next = function->next;
+	free (function);
+	function = next;
+    }
+
     UNWRAP (fs, s, preparePaintScreen);
     UNWRAP (fs, s, donePaintScreen);
     UNWRAP (fs, s, drawWindowTexture);
+    UNWRAP (fs, s, outputChangeNotify);
+    UNWRAP (fs, s, paintOutput);
 
     free (fs);
 }
@@ -1784,6 +5730,14 @@ frostInit (CompPlugin *p)
 	return FALSE;
     }
 
+    functionsPrivateIndex = allocateDisplayPrivateIndex ();
+    if (functionsPrivateIndex < 0)
+    {
+	freeDisplayPrivateIndex (displayPrivateIndex);
+	compFiniMetadata (&frostMetadata);
+	return FALSE;
+    }
+
     compAddMetadataFromFile (&frostMetadata, p->vTable->name);
 
     return TRUE;
@@ -1793,6 +5747,7 @@ static void
 frostFini (CompPlugin *p)
 {
     freeDisplayPrivateIndex (displayPrivateIndex);
+    freeDisplayPrivateIndex (functionsPrivateIndex);
     compFiniMetadata (&frostMetadata);
 }
 
@@ -0,0 +1,267 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Fuzzes the clipping and software rasterizers with random grids,
+   outputs, brushes and primitives. Every cell outside the grid, the
+   border included, holds a sentinel that must survive, and the clipped
+   vertices must stay where the rasterizers expect them. Amplitudes are
+   in [-1, 1], per vertex half of the time, and interpolating them must
+   not leave that range.
+
+   cc -O1 -g -fsanitize=address,undefined,float-cast-overflow -I.. \
+      -o frost-raster-fuzz frost-raster-fuzz.c ../frost-raster.c -lm
+   ./frost-raster-fuzz 100000 1 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../frost-raster.h"
+
+#define GUARD	    64
+#define SENTINEL    1234.5f
+#define MAX_GRID    96
+#define MAX_POINTS  48
+
+static unsigned int state;
+
+static unsigned int
+fuzzRandom (void)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+/* uniform in [lo, hi] */
+static int
+fuzzRange (int lo,
+	   int hi)
+{
+    return lo + (int) (fuzzRandom () % (unsigned int) (hi - lo + 1));
+}
+
+/* mostly around the output so that primitives cross its edges, often
+   right at the corners of the clip rectangle where rounding is most
+   likely to go wrong, now and then anywhere a short reaches */
+static void
+fuzzPoint (const FrostField *f,
+	   const FrostBrush *brush,
+	   XPoint	    *p)
+{
+    int x, y;
+
+    if (!fuzzRange (0, 3))
+    {
+	x = fuzzRange (0, 1) ? -brush->extent : f->width - 1 + brush->extent;
+	y = fuzzRange (0, 1) ? -brush->extent : f->height - 1 + brush->extent;
+
+	p->x = f->x + x * f->outputWidth / f->width + fuzzRange (-2, 2);
+	p->y = f->y + y * f->outputHeight / f->height + fuzzRange (-2, 2);
+    }
+    else if (fuzzRange (0, 7))
+    {
+	p->x = fuzzRange (f->x - f->outputWidth / 2,
+			  f->x + f->outputWidth * 3 / 2);
+	p->y = fuzzRange (f->y - f->outputHeight / 2,
+			  f->y + f->outputHeight * 3 / 2);
+    }
+    else
+    {
+	p->x = fuzzRange (-32768, 32767);
+	p->y = fuzzRange (-32768, 32767);
+    }
+}
+
+static int
+fuzzCheckVertices (const FrostField *f,
+		   const FrostBrush *brush,
+		   GLenum	    type,
+		   const XPoint	    *p,
+		   const float	    *amp,
+		   int		    n,
+		   int		    m)
+{
+    int i, size = (type == GL_TRIANGLES) ? 3 : (type == GL_LINES) ? 2 : 1;
+
+    if (m > ((type == GL_TRIANGLES) ? FROST_CLIP_SIZE (n) : n) || m % size)
+    {
+	fprintf (stderr, "type %d: %d vertices left of %d\n", type, m, n);
+	return 0;
+    }
+
+    /* rounding may leave a cut vertex one cell further out */
+    for (i = 0; i < m; i++)
+    {
+	if (p[i].x < -brush->extent - 1 || p[i].x > f->width + brush->extent ||
+	    p[i].y < -brush->extent - 1 || p[i].y > f->height + brush->extent)
+	{
+	    fprintf (stderr, "type %d: vertex %d at %d,%d outside the clip "
+		     "rectangle of a %dx%d grid with extent %d\n", type, i,
+		     p[i].x, p[i].y, f->width, f->height, brush->extent);
+	    return 0;
+	}
+
+	if (amp && !(fabsf (amp[i]) <= 1.0f + 1e-4f))
+	{
+	    fprintf (stderr, "type %d: vertex %d has amplitude %g\n", type,
+		     i, amp[i]);
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+static int
+fuzzCheckCells (const FrostField *f,
+		const float	 *buffer,
+		int		 size)
+{
+    int i, x, y;
+
+    for (i = 0; i < size; i++)
+    {
+	x = (i - GUARD) % f->pitch - 1;
+	y = (i - GUARD) / f->pitch - 1;
+
+	if (i >= GUARD && i < size - GUARD &&
+	    x >= 0 && x < f->width && y >= 0 && y < f->height)
+	{
+	    if (!(fabsf (buffer[i]) <= 1.0f + 1e-3f))
+	    {
+		fprintf (stderr, "cell %d,%d holds %g\n", x, y, buffer[i]);
+		return 0;
+	    }
+	}
+	else if (buffer[i] != SENTINEL)
+	{
+	    fprintf (stderr, "write outside a %dx%d grid at offset %d\n",
+		     f->width, f->height, i - GUARD);
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    static const GLenum types[] = { GL_POINTS, GL_LINES, GL_TRIANGLES };
+
+    FrostBrush brush = { 0 };
+    FrostField f;
+    XPoint     p[MAX_POINTS], q[FROST_CLIP_SIZE (MAX_POINTS)];
+    float      a[MAX_POINTS], b[FROST_CLIP_SIZE (MAX_POINTS)];
+    float      *buffer, *amp;
+    long       iterations = 100000, iteration;
+    int	       size, i, n, m, t, x, y;
+
+    if (argc > 1)
+	iterations = atol (argv[1]);
+
+    state = (argc > 2) ? strtoul (argv[2], NULL, 0) : 1;
+    if (!state)
+	state = 1;
+
+    size   = GUARD * 2 + (MAX_GRID + 2) * (MAX_GRID + 2);
+    buffer = malloc (sizeof (float) * size);
+    if (!buffer)
+	return 1;
+
+    for (iteration = 0; iteration < iterations; iteration++)
+    {
+	if (!frostBuildBrush (&brush, fuzzRange (1, 240) / 20.0f))
+	    return 1;
+
+	f.width	 = fuzzRange (1, MAX_GRID);
+	f.height = fuzzRange (1, MAX_GRID);
+	f.pitch	 = f.width + 2;
+
+	/* usually fewer cells than pixels, small outputs at a high
+	   resolution get up to four per pixel */
+	f.outputWidth  = (f.width  * fuzzRange (1, 96) + 3) / 4;
+	f.outputHeight = (f.height * fuzzRange (1, 96) + 3) / 4;
+	f.x	       = fuzzRange (-4096, 4096);
+	f.y	       = fuzzRange (-4096, 4096);
+
+	size = GUARD * 2 + f.pitch * (f.height + 2);
+
+	for (i = 0; i < size; i++)
+	    buffer[i] = SENTINEL;
+
+	for (y = 0; y < f.height; y++)
+	    for (x = 0; x < f.width; x++)
+		buffer[GUARD + f.pitch * (y + 1) + x + 1] = 0.0f;
+
+	f.d = buffer + GUARD + f.pitch + 1;
+
+	t = types[fuzzRange (0, 2)];
+	n = fuzzRange (0, MAX_POINTS);
+
+	for (i = 0; i < n; i++)
+	{
+	    fuzzPoint (&f, &brush, &p[i]);
+	    a[i] = fuzzRange (-1000, 1000) / 1000.0f;
+	}
+
+	amp = fuzzRange (0, 1) ? a : NULL;
+
+	m = frostClipVertices (&f, &brush, t, p, amp, n, q, b);
+
+	if (fuzzCheckVertices (&f, &brush, t, q, amp ? b : NULL, n, m))
+	{
+	    frostRasterVertices (&f, &brush, t, q, amp ? b : NULL, m,
+				 fuzzRange (-1000, 1000) / 1000.0f);
+
+	    if (fuzzCheckCells (&f, buffer, size))
+		continue;
+	}
+
+	fprintf (stderr, "output %d,%d %dx%d, grid %dx%d, radius %g\n",
+		 f.x, f.y, f.outputWidth, f.outputHeight, f.width, f.height,
+		 brush.radius);
+
+	for (i = 0; i < n; i++)
+	    fprintf (stderr, "    %d,%d\n", p[i].x, p[i].y);
+
+	break;
+    }
+
+    frostFreeBrush (&brush);
+    free (buffer);
+
+    if (iteration < iterations)
+    {
+	fprintf (stderr, "failed at iteration %ld\n", iteration);
+	return 1;
+    }
+
+    printf ("%ld iterations passed\n", iterations);
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Minimal producer for the frost shared memory input, for testing.
+   Draws a circling line strip and a slowly moving height bump.
+
+   cc -O2 -o frost-shm-producer frost-shm-producer.c -lrt -lm
+   ./frost-shm-producer /frost-0 10 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "../frost-shm.h"
+
+#define STRIP_POINTS 32
+
+int
+main (int  argc,
+      char **argv)
+{
+    FrostShm	 *shm;
+    const char	 *name = "/frost-0";
+    float	 seconds = 10.0f;
+    int		 file, frame, frames, i, x, y;
+
+    if (argc > 1)
+	name = argv[1];
+    if (argc > 2)
+	seconds = atof (argv[2]);
+
+    file = shm_open (name, O_RDWR, 0);
+    if (file < 0)
+    {
+	fprintf (stderr, "couldn't open %s, is shm_name set?\n", name);
+	return 1;
+    }
+
+    shm = mmap (NULL, sizeof (FrostShm), PROT_READ | PROT_WRITE, MAP_SHARED,
+		file, 0);
+    close (file);
+
+    if (shm == MAP_FAILED)
+	return 1;
+
+    if (shm->magic != FROST_SHM_MAGIC || shm->version != FROST_SHM_VERSION)
+    {
+	fprintf (stderr, "%s is not a frost input segment\n", name);
+	return 1;
+    }
+
+    frames = seconds * 60.0f;
+
+    for (frame = 0; frame < frames; frame++)
+    {
+	FrostShmSlot	*slot;
+	FrostShmHeights *h;
+	unsigned int	position, delta;
+	float		t = frame / 60.0f;
+
+	slot = frostShmBeginBatch (shm, &position);
+
+	slot->type	= FROST_SHM_LINES;
+	slot->amplitude = 0.3f;
+	slot->n		= 2 * (STRIP_POINTS - 1);
+
+	for (i = 0; i < STRIP_POINTS; i++)
+	{
+	    float a = t + i * 0.05f;
+	    short px = shm->width / 2 + cosf (a) * shm->height / 3;
+	    short py = shm->height / 2 + sinf (a * 1.3f) * shm->height / 3;
+
+	    if (i > 0)
+	    {
+		slot->p[2 * i - 1].x = px;
+		slot->p[2 * i - 1].y = py;
+	    }
+	    if (i < STRIP_POINTS - 1)
+	    {
+		slot->p[2 * i].x = px;
+		slot->p[2 * i].y = py;
+	    }
+	}
+
+	frostShmCommitBatch (slot, position);
+
+	/* a small bump every fourth frame */
+	if (!(frame & 3))
+	{
+	    h = frostShmBeginHeights (shm, &delta);
+
+	    h->width  = 64;
+	    h->height = 64;
+
+	    for (y = 0; y < 64; y++)
+	    {
+		for (x = 0; x < 64; x++)
+		{
+		    float dx = x - 32.0f - 24.0f * cosf (t * 0.5f);
+		    float dy = y - 32.0f;
+
+		    h->d[y * 64 + x] = 0.02f * expf (-(dx * dx + dy * dy) /
+						      8.0f);
+		}
+	    }
+
+	    frostShmCommitHeights (shm, h, delta);
+	}
+
+	usleep (1000000 / 60);
+    }
+
+    munmap (shm, sizeof (FrostShm));
+
+    return 0;
+}
@@ -0,0 +1,357 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Records a known stroke the way the plugin does, reads the file back
+   with the reader frostReplay uses and checks that replaying it leaves
+   the grid exactly as drawing the stroke directly did, amplitudes per
+   point included. Also checks that a second session appended to the
+   file replays, that a trace cut short replays up to the cut and that a
+   file with a bad start record is refused.
+
+   cc -O2 -I.. -o frost-trace-roundtrip frost-trace-roundtrip.c \
+      ../frost-raster.c -lm
+   ./frost-trace-roundtrip */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "../frost-raster.h"
+#include "../frost-trace.h"
+
+#define GRID_WIDTH   80
+#define GRID_HEIGHT  60
+#define STROKE_LINES 40
+
+static float live[(GRID_WIDTH + 2) * (GRID_HEIGHT + 2)];
+static float replayed[(GRID_WIDTH + 2) * (GRID_HEIGHT + 2)];
+
+static void
+initField (FrostField *f,
+	   float      *cells)
+{
+    memset (cells, 0, sizeof (float) * (GRID_WIDTH + 2) * (GRID_HEIGHT + 2));
+
+    f->width	    = GRID_WIDTH;
+    f->height	    = GRID_HEIGHT;
+    f->pitch	    = GRID_WIDTH + 2;
+    f->d	    = cells + f->pitch + 1;
+    f->x	    = 0;
+    f->y	    = 0;
+    f->outputWidth  = 800;
+    f->outputHeight = 600;
+}
+
+/* what frostVertices does for one grid */
+static void
+drawVertices (FrostField       *f,
+	      const FrostBrush *brush,
+	      GLenum	       type,
+	      const XPoint     *p,
+	      const float      *amp,
+	      int	       n,
+	      float	       v)
+{
+    XPoint clipped[FROST_CLIP_SIZE (2 * STROKE_LINES)];
+    float  clippedAmp[FROST_CLIP_SIZE (2 * STROKE_LINES)];
+    int	   m;
+
+    m = frostClipVertices (f, brush, type, p, amp, n, clipped, clippedAmp);
+    frostRasterVertices (f, brush, type, clipped, amp ? clippedAmp : NULL,
+			 m, v);
+}
+
+static void
+writeRecord (FILE	      *file,
+	     FrostTraceRecord *r,
+	     const void	      *payload,
+	     int	      size)
+{
+    fwrite (r, sizeof (*r), 1, file);
+    if (size)
+	fwrite (payload, size, 1, file);
+}
+
+/* what frostAmplitudeVertices records */
+static void
+writeVertices (FILE		*file,
+	       FrostTraceRecord *r,
+	       const XPoint	*p,
+	       const float	*amp)
+{
+    if (amp)
+	r->flags = TRACE_AMPLITUDES;
+
+    writeRecord (file, r, p, sizeof (XPoint) * r->b);
+    if (amp)
+	fwrite (amp, sizeof (float), r->b, file);
+}
+
+static void
+writeStart (FILE *file,
+	    int	 magic)
+{
+    FrostTraceRecord r;
+
+    memset (&r, 0, sizeof (r));
+
+    r.kind = TRACE_START;
+    r.a	   = magic;
+    r.b	   = TRACE_VERSION;
+
+    writeRecord (file, &r, NULL, 0);
+}
+
+/* a wavy line out past the right edge, a few stamps, a triangle and a
+   strip with an amplitude per point, separated by steps, drawn live and
+   recorded at the same time */
+static int
+recordStroke (FILE	       *file,
+	      FrostField       *f,
+	      const FrostBrush *brush,
+	      int	       screen)
+{
+    FrostTraceRecord r;
+    XPoint	     p[2 * STROKE_LINES];
+    float	     amp[2 * STROKE_LINES];
+    int		     i, n = 0;
+
+    for (i = 0; i < STROKE_LINES; i++)
+    {
+	p[2 * i].x     = 100 + i * 20;
+	p[2 * i].y     = 300 + 120 * sinf (i * 0.3f);
+	p[2 * i + 1].x = 100 + (i + 1) * 20;
+	p[2 * i + 1].y = 300 + 120 * sinf ((i + 1) * 0.3f);
+    }
+
+    memset (&r, 0, sizeof (r));
+    r.kind   = TRACE_VERTICES;
+    r.screen = screen;
+    r.a	     = GL_LINES;
+    r.b	     = 2 * STROKE_LINES;
+    r.f0     = 0.4f;
+
+    drawVertices (f, brush, r.a, p, NULL, r.b, r.f0);
+    writeVertices (file, &r, p, NULL);
+    n++;
+
+    memset (&r, 0, sizeof (r));
+    r.kind   = TRACE_STEP;
+    r.screen = screen;
+    r.a	     = 2;
+
+    writeRecord (file, &r, NULL, 0);
+
+    p[0].x = 50;  p[0].y = 40;
+    p[1].x = 400; p[1].y = 590;
+    p[2].x = 790; p[2].y = 10;
+
+    memset (&r, 0, sizeof (r));
+    r.kind   = TRACE_VERTICES;
+    r.screen = screen;
+    r.a	     = GL_POINTS;
+    r.b	     = 3;
+    r.f0     = -0.7f;
+
+    drawVertices (f, brush, r.a, p, NULL, r.b, r.f0);
+    writeVertices (file, &r, p, NULL);
+    n++;
+
+    p[0].x = 200; p[0].y = 500;
+    p[1].x = 600; p[1].y = 450;
+    p[2].x = 420; p[2].y = 80;
+
+    memset (&r, 0, sizeof (r));
+    r.kind   = TRACE_VERTICES;
+    r.screen = screen;
+    r.a	     = GL_TRIANGLES;
+    r.b	     = 3;
+    r.f0     = 0.1f;
+
+    drawVertices (f, brush, r.a, p, NULL, r.b, r.f0);
+    writeVertices (file, &r, p, NULL);
+    n++;
+
+    for (i = 0; i < 2 * STROKE_LINES; i++)
+    {
+	p[i].x = 60 + (i / 2 + i % 2) * 17;
+	p[i].y = 520 - 90 * cosf ((i / 2 + i % 2) * 0.2f);
+	amp[i] = sinf ((i / 2 + i % 2) * 0.45f);
+    }
+
+    memset (&r, 0, sizeof (r));
+    r.kind   = TRACE_VERTICES;
+    r.screen = screen;
+    r.a	     = GL_LINES;
+    r.b	     = 2 * STROKE_LINES;
+    r.f0     = 0.5f;
+
+    drawVertices (f, brush, r.a, p, amp, r.b, r.f0);
+    writeVertices (file, &r, p, amp);
+    n++;
+
+    return n;
+}
+
+/* replay every vertices record of screen, returns what the reader ended
+   with and the number of records replayed in n */
+static int
+replay (const char	 *path,
+	long		 size,
+	FrostField	 *f,
+	const FrostBrush *brush,
+	int		 screen,
+	int		 *n)
+{
+    FrostTraceReader reader;
+    FrostTraceRecord r;
+    const void	     *points, *amplitudes;
+    unsigned char    *data;
+    XPoint	     p[2 * STROKE_LINES];
+    float	     amp[2 * STROKE_LINES];
+    FILE	     *file;
+    int		     result;
+
+    data = malloc (size);
+    file = fopen (path, "rb");
+    if (!data || !file || fread (data, 1, size, file) != (size_t) size)
+    {
+	fprintf (stderr, "couldn't read back %s\n", path);
+	exit (1);
+    }
+    fclose (file);
+
+    *n = 0;
+
+    frostTraceBegin (&reader, data, size);
+
+    while ((result = frostTraceNext (&reader, &r, &points,
+				     &amplitudes)) > 0)
+    {
+	if (r.kind != TRACE_VERTICES || r.screen != screen)
+	    continue;
+
+	if (r.b > 2 * STROKE_LINES)
+	{
+	    result = -1;
+	    break;
+	}
+
+	memcpy (p, points, sizeof (XPoint) * r.b);
+	if (amplitudes)
+	    memcpy (amp, amplitudes, sizeof (float) * r.b);
+
+	drawVertices (f, brush, r.a, p, amplitudes ? amp : NULL, r.b, r.f0);
+	(*n)++;
+    }
+
+    free (data);
+
+    return result;
+}
+
+static long
+fileSize (FILE *file)
+{
+    fflush (file);
+    fseek (file, 0, SEEK_END);
+
+    return ftell (file);
+}
+
+static int
+check (int	  ok,
+       const char *what)
+{
+    printf ("%s: %s\n", ok ? "ok" : "FAILED", what);
+
+    return ok;
+}
+
+int
+main (void)
+{
+    FrostBrush brush = { 0 };
+    FrostField a, b;
+    FILE       *file;
+    char       path[] = "/tmp/frost-trace-XXXXXX";
+    long       size;
+    int	       fd, recorded, n, result, ok = 1;
+
+    if (!frostBuildBrush (&brush, 2.5f))
+	return 1;
+
+    fd = mkstemp (path);
+    if (fd < 0 || !(file = fdopen (fd, "w+b")))
+	return 1;
+
+    /* one session on screen 0, then an appended one on screen 1 */
+    initField (&a, live);
+
+    writeStart (file, TRACE_MAGIC);
+    recorded = recordStroke (file, &a, &brush, 0);
+
+    initField (&b, replayed);
+    writeStart (file, TRACE_MAGIC);
+    recordStroke (file, &b, &brush, 1);
+
+    size = fileSize (file);
+
+    initField (&b, replayed);
+    result = replay (path, size, &b, &brush, 0, &n);
+
+    ok &= check (result == 0 && n == recorded,
+		 "every record of the first session is read back");
+    ok &= check (!memcmp (live, replayed, sizeof (live)),
+		 "replayed grid matches the live one");
+
+    initField (&b, replayed);
+    result = replay (path, size, &b, &brush, 1, &n);
+
+    ok &= check (result == 0 && n == recorded && !memcmp (live, replayed,
+							  sizeof (live)),
+		 "appended session replays the same");
+
+    /* cut into the points of the last record */
+    initField (&b, replayed);
+    result = replay (path, size - 2, &b, &brush, 1, &n);
+
+    ok &= check (result == 0 && n == recorded - 1,
+		 "trace cut short replays up to the cut");
+
+    rewind (file);
+    writeStart (file, ~TRACE_MAGIC);
+    fflush (file);
+
+    initField (&b, replayed);
+    result = replay (path, size, &b, &brush, 0, &n);
+
+    ok &= check (result < 0 && n == 0, "bad start record is refused");
+
+    fclose (file);
+    unlink (path);
+    frostFreeBrush (&brush);
+
+    return ok ? 0 : 1;
+}
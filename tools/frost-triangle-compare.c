@@ -0,0 +1,210 @@
+/*
+ * Copyright © 2006 Novell, Inc.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * Novell, Inc. not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior permission.
+ * Novell, Inc. makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * NOVELL, INC. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL NOVELL, INC. BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compares the software triangle fill with the cells the FBO path
+   covers. fboVertices draws vertex (x, y) at the centre of cell (x, y),
+   and GL covers a cell when its centre is inside the triangle, so the
+   reference is whether lattice point (x, y) is inside the triangle with
+   the unmodified integer vertices. Centres exactly on an edge are
+   covered by one of the triangles sharing it, which one depends on the
+   GL implementation, so they may go either way. Zero area triangles
+   cover nothing on the GPU.
+
+   cc -O2 -I.. -o frost-triangle-compare frost-triangle-compare.c \
+      ../frost-raster.c -lm
+   ./frost-triangle-compare 100000 1 */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../frost-raster.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define MAX_GRID 64
+
+#define OUTSIDE 0
+#define INSIDE	1
+#define EDGE	2
+
+static unsigned int state;
+
+static unsigned int
+compareRandom (void)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+/* uniform in [lo, hi] */
+static int
+compareRange (int lo,
+	      int hi)
+{
+    return lo + (int) (compareRandom () % (unsigned int) (hi - lo + 1));
+}
+
+static long long
+edgeFunction (const XPoint *a,
+	      const XPoint *b,
+	      int	   x,
+	      int	   y)
+{
+    return (long long) (b->x - a->x) * (y - a->y) -
+	   (long long) (b->y - a->y) * (x - a->x);
+}
+
+static int
+reference (const XPoint *t,
+	   int		x,
+	   int		y)
+{
+    long long area, e;
+    int	      i, edge = 0;
+
+    area = edgeFunction (&t[0], &t[1], t[2].x, t[2].y);
+
+    for (i = 0; i < 3; i++)
+    {
+	e = edgeFunction (&t[i], &t[(i + 1) % 3], x, y);
+
+	if (!area)
+	{
+	    /* on the segment the vertices span, or nowhere */
+	    if (e)
+		return OUTSIDE;
+	    continue;
+	}
+
+	if ((area > 0) ? e < 0 : e > 0)
+	    return OUTSIDE;
+
+	if (!e)
+	    edge = 1;
+    }
+
+    if (!area)
+    {
+	int xMin = MIN (t[0].x, MIN (t[1].x, t[2].x));
+	int xMax = MAX (t[0].x, MAX (t[1].x, t[2].x));
+	int yMin = MIN (t[0].y, MIN (t[1].y, t[2].y));
+	int yMax = MAX (t[0].y, MAX (t[1].y, t[2].y));
+
+	if (x < xMin || x > xMax || y < yMin || y > yMax)
+	    return OUTSIDE;
+
+	return EDGE;
+    }
+
+    return edge ? EDGE : INSIDE;
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    static float cells[(MAX_GRID + 2) * (MAX_GRID + 2)];
+
+    FrostField f;
+    XPoint     t[3];
+    long       iterations = 100000, iteration, inside = 0, edge = 0;
+    long       edgeCovered = 0;
+    int	       i, x, y, e, r, covered;
+
+    if (argc > 1)
+	iterations = atol (argv[1]);
+
+    state = (argc > 2) ? strtoul (argv[2], NULL, 0) : 1;
+    if (!state)
+	state = 1;
+
+    for (iteration = 0; iteration < iterations; iteration++)
+    {
+	f.width	 = compareRange (1, MAX_GRID);
+	f.height = compareRange (1, MAX_GRID);
+	f.pitch	 = f.width + 2;
+	f.d	 = cells + f.pitch + 1;
+
+	for (i = 0; i < f.pitch * (f.height + 2); i++)
+	    cells[i] = 0.0f;
+
+	/* the range clipped vertices end up in, small triangles often
+	   enough that edges and degenerate cases come up */
+	e = compareRange (2, 8);
+	r = compareRange (0, 3) ? MAX (f.width, f.height) + e : 3;
+
+	t[0].x = compareRange (-e, f.width - 1 + e);
+	t[0].y = compareRange (-e, f.height - 1 + e);
+
+	for (i = 1; i < 3; i++)
+	{
+	    t[i].x = MIN (MAX (t[0].x + compareRange (-r, r), -e),
+			  f.width - 1 + e);
+	    t[i].y = MIN (MAX (t[0].y + compareRange (-r, r), -e),
+			  f.height - 1 + e);
+	}
+
+	frostRasterVertices (&f, NULL, GL_TRIANGLES, t, NULL, 3, 1.0f);
+
+	for (y = 0; y < f.height; y++)
+	{
+	    for (x = 0; x < f.width; x++)
+	    {
+		covered = f.d[f.pitch * y + x] != 0.0f;
+
+		switch (reference (t, x, y)) {
+		case INSIDE:
+		    inside++;
+		    if (covered)
+			continue;
+		    break;
+		case OUTSIDE:
+		    if (!covered)
+			continue;
+		    break;
+		default:
+		    edge++;
+		    edgeCovered += covered;
+		    continue;
+		}
+
+		fprintf (stderr, "cell %d,%d %s, triangle %d,%d %d,%d %d,%d "
+			 "on a %dx%d grid\n", x, y,
+			 covered ? "covered outside" : "missed inside",
+			 t[0].x, t[0].y, t[1].x, t[1].y, t[2].x, t[2].y,
+			 f.width, f.height);
+
+		return 1;
+	    }
+	}
+    }
+
+    printf ("%ld triangles match, %ld cells inside and %ld on an edge, "
+	    "%ld of those covered\n", iterations, inside, edge, edgeCovered);
+
+    return 0;
+}